@@ -19,6 +19,13 @@ static std::map<std::string, arg_parse> cprintf_args_create(void)
 
 	ret["log_level"] = &log::set_log_level;
 	ret["printf"] = &printfun::add_printfun;
+	ret["min_level"] = &printfun::add_level_filter;
+	ret["ratelimit"] = &printfun::add_ratelimit;
+	ret["profile"] = &printfun::set_profile;
+	ret["outline"] = &printfun::set_outline;
+	ret["batch"] = &printfun::set_batch;
+	ret["cold"] = &printfun::set_cold_policy;
+	ret["cost"] = &printfun::set_cost_model;
 
 	return ret;
 }
@@ -87,5 +94,18 @@ int plugin_init(struct plugin_name_args *info,
 	register_callback(info->base_name, PLUGIN_PASS_MANAGER_SETUP,
 			NULL, &pass_info);
 
+	/*
+	 * Pending cold call sites are decided by the counts, which are
+	 * read by IPA profile pass, next to GCC's own feedback splitting.
+	 */
+	pass_info.pass = new gcc_hell::cprintf_profile_pass(g);
+	pass_info.reference_pass_name = "feedback_fnsplit";
+	pass_info.ref_pass_instance_number = 1;
+	pass_info.pos_op = PASS_POS_INSERT_BEFORE;
+
+	register_callback(info->base_name, PLUGIN_PASS_MANAGER_SETUP,
+			NULL, &pass_info);
+	gcc_hell::register_ggc_roots(info->base_name);
+
 	return 0;
 }
@@ -1,12 +1,12 @@
+#include <algorithm>
 #include <vector>
+#include <map>
 #include "log.h"
 #include "gcc_hell.h"
 #include "printfun.h"
 
 namespace gcc_hell {
 
-const size_t prefer_puts = 1;
-
 static const pass_data init_pass_data = {
 	GIMPLE_PASS,
 	"cprintf_walk",
@@ -18,6 +18,20 @@ static const pass_data init_pass_data = {
 	0			/* todo_flags_finish */
 };
 
+static const pass_data profile_pass_data = {
+	GIMPLE_PASS,
+	"cprintf_profile",
+	OPTGROUP_NONE, TV_NONE,
+	PROP_cfg | PROP_ssa,	/* properties_required */
+	0,			/* properties_provided */
+	0,			/* properties_destroyed */
+	0,			/* todo_flags_start */
+	0			/* todo_flags_finish */
+};
+
+static bool resolve_pending_call(function *fun, gimple_stmt_iterator *gsi,
+		gcall *call);
+
 static tree create_string_param(tree string)
 {
 	tree i_type, a_type;
@@ -58,6 +72,41 @@ unsigned int cprintf_pass::execute(function *fun)
 	return 0;
 }
 
+cprintf_profile_pass::cprintf_profile_pass(gcc::context *ctx)
+	: gimple_opt_pass(profile_pass_data, ctx)
+{
+}
+
+bool cprintf_profile_pass::gate(function *)
+{
+	return pending_fns_exist();
+}
+
+unsigned int cprintf_profile_pass::execute(function *fun)
+{
+	bool changed = false;
+	basic_block bb;
+
+	log::info << "*** cprintf profile for function `"
+		<< function_name(fun) << "'" << std::endl;
+
+	FOR_EACH_BB_FN(bb, fun) {
+		gimple_stmt_iterator gsi;
+
+		for (gsi = gsi_start_bb(bb); !gsi_end_p(gsi); gsi_next(&gsi)) {
+			gcall *call = dyn_cast<gcall *>(gsi_stmt(gsi));
+
+			if (call != NULL && resolve_pending_call(fun, &gsi, call))
+				changed = true;
+		}
+	}
+	/* Inlining is allowed or callee is changed at some calls */
+	if (changed)
+		cgraph_edge::rebuild_edges();
+
+	return 0;
+}
+
 tree cprintf_pass::callback_op(tree *t, int *, void *data)
 {
 	return NULL;
@@ -119,9 +168,36 @@ static inline tree printfun_get_const_fmt(gcall *stmt, const char *func_name)
 }
 
 
-static void handle_printfunc(gimple_stmt_iterator *gsi,
+static bool handle_printfunc(gimple_stmt_iterator *gsi,
 	struct walk_stmt_info *wi, gcall *stmt,
 	const char *func_name, tree const_fmt);
+static void insert_lhs_assign(gimple_stmt_iterator *gsi, tree lhs, tree val);
+
+static bool handle_printfunc_batch(gimple_stmt_iterator *gsi,
+		struct walk_stmt_info *wi, gcall *stmt, const char *func_name);
+
+/* Is the call compiled out by constant level in prefix argument? */
+static bool printfun_filtered_out(gcall *stmt, const char *func_name)
+{
+	printfun::printfun_t &pf = printfun::printfuns.at(func_name);
+
+	for (size_t i = 0; i < printfun::level_filters.size(); i++) {
+		const printfun::level_filter_t &f = printfun::level_filters[i];
+		tree level;
+
+		if ((!f.func.empty() && f.func != func_name) ||
+				f.arg >= pf.fmt_pos ||
+				f.arg >= gimple_call_num_args(stmt))
+			continue;
+		level = gimple_call_arg(stmt, f.arg);
+		if (TREE_CODE(level) != INTEGER_CST ||
+				!tree_fits_shwi_p(level))
+			continue;
+		if (!printfun::level_filter_allows(f, tree_to_shwi(level)))
+			return true;
+	}
+	return false;
+}
 
 tree cprintf_pass::callback_stmt(gimple_stmt_iterator *gsi,
 			bool *handled_all_ops, struct walk_stmt_info *wi)
@@ -153,6 +229,18 @@ tree cprintf_pass::callback_stmt(gimple_stmt_iterator *gsi,
 	if (!func_is_printfun(func_name))
 		return NULL;
 
+	if (printfun_filtered_out(call_stmt, func_name)) {
+		log::info << "\t\tDeleting `" << func_name
+			<< "' call below level floor\n";
+		if (gimple_call_lhs(call_stmt) != NULL_TREE)
+			insert_lhs_assign(gsi, gimple_call_lhs(call_stmt),
+				build_int_cst(TREE_TYPE(
+					gimple_call_lhs(call_stmt)), 0));
+		gsi_remove(gsi, true);
+		wi->removed_stmt = true;
+		return NULL;
+	}
+
 	log::debug << "\tChecking `"
 		<< func_name << "' for constant fmt string\n";
 
@@ -160,6 +248,10 @@ tree cprintf_pass::callback_stmt(gimple_stmt_iterator *gsi,
 	if (const_fmt == NULL_TREE)
 		return NULL;
 
+	if (printfun::batch_calls &&
+			handle_printfunc_batch(gsi, wi, call_stmt, func_name))
+		return NULL;
+
 	handle_printfunc(gsi, wi, call_stmt,
 			func_name, const_fmt);
 
@@ -184,6 +276,8 @@ static std::string specifier_search(const char *fmt,
 		}
 
 		range = pf.spec_to_func.equal_range(spec);
+		if (range.first == pf.spec_to_func.end())
+			break;
 		next_str = range.first->first;
 		if (next_str.compare(0, spec.length(), spec))
 			break;
@@ -192,69 +286,612 @@ static std::string specifier_search(const char *fmt,
 	return ret;
 }
 
-static std::vector<std::pair<std::string, bool>>
-tokens_create(const char *fmt, const printfun::printfun_t &pf)
+/*
+ * Flags of printf conversion specification, passed to `%~'-handlers
+ */
+enum conv_flags_t {
+	CONV_FLAG_LEFT	= 1 << 0,	/* '-' */
+	CONV_FLAG_SIGN	= 1 << 1,	/* '+' */
+	CONV_FLAG_SPACE	= 1 << 2,	/* ' ' */
+	CONV_FLAG_ALT	= 1 << 3,	/* '#' */
+	CONV_FLAG_ZERO	= 1 << 4,	/* '0' */
+};
+
+static const char conv_flag_chars[] = "-+ #0";
+
+/* Longest width/precision, for which cprintf generates anything */
+const int conv_max_width = 4096;
+
+/*
+ * Standard printf conversion specification:
+ * %[n$][flags][width][.precision][length]conversion
+ */
+struct conv_spec_t {
+	unsigned int	pos;		/* `n$' argument, 0 if not specified */
+	unsigned int	flags;
+	int		width;		/* -1 if not specified */
+	int		prec;		/* -1 if not specified */
+	bool		width_arg;	/* `*' width */
+	bool		prec_arg;	/* `.*' precision */
+	unsigned int	width_pos;	/* `*m$' width */
+	unsigned int	prec_pos;	/* `.*m$' precision */
+	std::string	len;
+	char		conv;
+	size_t		parsed;		/* length of specification */
+};
+
+static const char *parse_conv_number(const char *fmt, int *out)
+{
+	long n = 0;
+
+	while (ISDIGIT(*fmt)) {
+		n = n * 10 + (*fmt++ - '0');
+		if (n > conv_max_width)
+			return NULL;
+	}
+	*out = n;
+	return fmt;
+}
+
+/* Parses `n$' argument position, if there is one */
+static const char *parse_conv_pos(const char *fmt, unsigned int *pos)
+{
+	const char *p;
+	int n;
+
+	*pos = 0;
+	if (!ISDIGIT(*fmt))
+		return fmt;
+	p = parse_conv_number(fmt, &n);
+	if (p == NULL || *p != '$' || n == 0)
+		return fmt;
+	*pos = n;
+
+	return p + 1;
+}
+
+/* Parses conversion specification, that starts after '%' */
+static bool parse_conv_spec(const char *fmt, conv_spec_t *cs)
+{
+	static const char *lengths[] = {
+		"hh", "h", "ll", "l", "L", "q", "j", "z", "t",
+	};
+	const char *start = fmt;
+	const char *flag;
+
+	cs->flags = 0;
+	cs->width = -1;
+	cs->prec = -1;
+	cs->width_arg = false;
+	cs->prec_arg = false;
+	cs->len.clear();
+
+	fmt = parse_conv_pos(fmt, &cs->pos);
+	while (*fmt != '\0' &&
+			(flag = strchr(conv_flag_chars, *fmt)) != NULL) {
+		cs->flags |= 1U << (flag - conv_flag_chars);
+		fmt++;
+	}
+
+	if (*fmt == '*') {
+		cs->width_arg = true;
+		fmt = parse_conv_pos(fmt + 1, &cs->width_pos);
+	} else if (ISDIGIT(*fmt)) {
+		fmt = parse_conv_number(fmt, &cs->width);
+		if (fmt == NULL)
+			return false;
+	}
+
+	if (*fmt == '.' && *(fmt + 1) == '*') {
+		cs->prec_arg = true;
+		fmt = parse_conv_pos(fmt + 2, &cs->prec_pos);
+	} else if (*fmt == '.') {
+		fmt = parse_conv_number(fmt + 1, &cs->prec);
+		if (fmt == NULL)
+			return false;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(lengths); i++) {
+		size_t l = strlen(lengths[i]);
+
+		if (!strncmp(fmt, lengths[i], l)) {
+			cs->len = lengths[i];
+			fmt += l;
+			break;
+		}
+	}
+
+	if (*fmt == '\0' || strchr("diouxXeEfFgGaAcspnm", *fmt) == NULL)
+		return false;
+	cs->conv = *fmt++;
+	cs->parsed = fmt - start;
+
+	return true;
+}
+
+/* Number of printf-like arguments, consumed by specification */
+static inline unsigned int conv_nargs(const conv_spec_t &cs)
+{
+	return 1 + cs.width_arg + cs.prec_arg;
+}
+
+/*
+ * Resolves `*' width and precision if their arguments are constants,
+ * the way printf() does that: negative width is `-' flag, negative
+ * precision is taken as if it was omitted.
+ */
+static bool conv_resolve_const_args(conv_spec_t *cs, gcall *stmt,
+		const std::vector<unsigned int> &args)
+{
+	size_t arg = 0;
+
+	if (cs->width_arg) {
+		tree w = gimple_call_arg(stmt, args[arg++]);
+
+		if (TREE_CODE(w) != INTEGER_CST || !tree_fits_shwi_p(w))
+			return false;
+		cs->width = tree_to_shwi(w);
+		if (cs->width < 0) {
+			cs->flags |= CONV_FLAG_LEFT;
+			cs->width = -cs->width;
+		}
+		if (cs->width > conv_max_width)
+			return false;
+		cs->width_arg = false;
+	}
+
+	if (cs->prec_arg) {
+		tree p = gimple_call_arg(stmt, args[arg]);
+
+		if (TREE_CODE(p) != INTEGER_CST || !tree_fits_shwi_p(p))
+			return false;
+		cs->prec = tree_to_shwi(p);
+		if (cs->prec < 0)
+			cs->prec = -1;
+		if (cs->prec > conv_max_width)
+			return false;
+		cs->prec_arg = false;
+	}
+
+	return true;
+}
+
+/*
+ * Conversion specification as printf() format, without
+ * argument positions, length and conversion
+ */
+static std::string conv_spec_prefix(const conv_spec_t &cs)
+{
+	std::string ret("%");
+
+	for (size_t i = 0; conv_flag_chars[i] != '\0'; i++)
+		if (cs.flags & (1U << i))
+			ret += conv_flag_chars[i];
+	if (cs.width_arg)
+		ret += "*";
+	else if (cs.width >= 0)
+		ret += std::to_string(cs.width);
+	if (cs.prec_arg)
+		ret += ".*";
+	else if (cs.prec >= 0)
+		ret += "." + std::to_string(cs.prec);
+
+	return ret;
+}
+
+/*
+ * Part of format string: either literal text to output as-is
+ * or specifier, which handler should be called for `args' of
+ * printf-like function. For `%~'-handlers flags, width and
+ * precision from conversion specification are passed, too.
+ * Handler `func' is chosen by type of the `value' argument,
+ * which is converted to `value_type' before the call.
+ */
+struct token_t {
+	std::string			str;
+	bool				spec;
+	std::vector<unsigned int>	args;
+	bool				fmt_args;
+	conv_spec_t			cs;
+	std::string			func;
+	tree				value;
+	tree				value_type;
+};
+
+/*
+ * Returns the string, if printf-like argument is the address of
+ * string literal or of read-only initialized array, NULL otherwise.
+ */
+static const char *get_const_string_arg(tree arg)
+{
+	tree str = NULL_TREE;
+
+	if (TREE_CODE(arg) != ADDR_EXPR)
+		return NULL;
+	arg = TREE_OPERAND(arg, 0);
+	if (TREE_CODE(arg) == ARRAY_REF &&
+			integer_zerop(TREE_OPERAND(arg, 1)))
+		arg = TREE_OPERAND(arg, 0);
+
+	if (TREE_CODE(arg) == STRING_CST) {
+		str = arg;
+	} else if (TREE_CODE(arg) == VAR_DECL && TREE_READONLY(arg) &&
+			TREE_STATIC(arg) && !TREE_THIS_VOLATILE(arg) &&
+			!DECL_WEAK(arg) && DECL_INITIAL(arg) != NULL_TREE &&
+			TREE_CODE(DECL_INITIAL(arg)) == STRING_CST) {
+		str = DECL_INITIAL(arg);
+	}
+
+	if (str == NULL_TREE)
+		return NULL;
+	/* Not NUL-terminated array, let the handler deal with it */
+	if (memchr(TREE_STRING_POINTER(str), '\0',
+				TREE_STRING_LENGTH(str)) == NULL)
+		return NULL;
+
+	return TREE_STRING_POINTER(str);
+}
+
+static bool conv_sprintf(std::string *out, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+	if (len < 0)
+		return false;
+
+	std::vector<char> buf(len + 1);
+	va_start(args, fmt);
+	vsnprintf(&buf[0], buf.size(), fmt, args);
+	va_end(args);
+	out->assign(&buf[0], len);
+
+	return true;
+}
+
+/*
+ * Renders integer constant argument of standard integer conversion
+ * the same way printf() would do at runtime.
+ */
+static bool fold_int_const(const conv_spec_t &cs, tree arg,
+		std::string *out)
+{
+	bool is_signed = (cs.conv == 'd' || cs.conv == 'i');
+	std::string fmt = conv_spec_prefix(cs);
+	tree type;
+
+	if (TREE_CODE(arg) != INTEGER_CST)
+		return false;
+	if (strchr("cdiouxX", cs.conv) == NULL)
+		return false;
+
+	if (cs.conv == 'c' && cs.len.empty())
+		type = unsigned_char_type_node;
+	else if (cs.conv == 'c')
+		return false;
+	else if (cs.len.empty())
+		type = is_signed ? integer_type_node : unsigned_type_node;
+	else if (cs.len == "hh")
+		type = is_signed ? signed_char_type_node
+			: unsigned_char_type_node;
+	else if (cs.len == "h")
+		type = is_signed ? short_integer_type_node
+			: short_unsigned_type_node;
+	else if (cs.len == "l")
+		type = is_signed ? long_integer_type_node
+			: long_unsigned_type_node;
+	else if (cs.len == "ll" || cs.len == "q" || cs.len == "j")
+		type = is_signed ? long_long_integer_type_node
+			: long_long_unsigned_type_node;
+	else if (cs.len == "z" || cs.len == "t")
+		type = is_signed ? signed_type_for(size_type_node)
+			: size_type_node;
+	else
+		return false;
+
+	if (TYPE_PRECISION(type) > HOST_BITS_PER_WIDE_INT)
+		return false;
+	arg = fold_convert(type, arg);
+
+	if (cs.conv == 'c') {
+		int c = (unsigned char)tree_to_uhwi(arg);
+
+		/* Literal parts may be printed with %s-handler */
+		if (c == '\0')
+			return false;
+		return conv_sprintf(out, (fmt + "c").c_str(), c);
+	}
+
+	fmt += "ll";
+	fmt += cs.conv;
+	if (is_signed)
+		return conv_sprintf(out, fmt.c_str(),
+				(long long)tree_to_shwi(arg));
+	return conv_sprintf(out, fmt.c_str(),
+			(unsigned long long)tree_to_uhwi(arg));
+}
+
+/*
+ * Renders constant argument of printf-like function into string
+ * if that's possible at compile time.
+ */
+static bool fold_const_arg(const conv_spec_t &cs, tree arg,
+		std::string *out)
+{
+	if (cs.conv == 's') {
+		const char *str = get_const_string_arg(arg);
+
+		if (str == NULL || !cs.len.empty())
+			return false;
+		return conv_sprintf(out,
+				(conv_spec_prefix(cs) + "s").c_str(), str);
+	}
+
+	return fold_int_const(cs, arg, out);
+}
+
+/*
+ * Finds handler for specifier at fmt: exact spelling from plugin
+ * parameters goes first (so one can define `%08x' handler), then
+ * `%~'-handler for conversion with flags, width or precision.
+ * Returns length of specifier in format string or 0.
+ */
+static size_t token_spec_search(const char *fmt,
+		const printfun::printfun_t &pf, token_t *token)
+{
+	conv_spec_t &cs = token->cs;
+	bool std_spec = parse_conv_spec(fmt, &cs);
+	std::string spec;
+
+	token->spec = true;
+	token->fmt_args = false;
+
+	/* Look up positional specifier by spelling without positions */
+	if (std_spec && cs.pos != 0) {
+		spec = conv_spec_prefix(cs).substr(1) + cs.len + cs.conv;
+		if (pf.spec_to_func.find(spec) == pf.spec_to_func.end())
+			spec.clear();
+	} else {
+		spec = specifier_search(fmt, pf);
+	}
+
+	if (spec.length() != 0 && !printfun::is_reserved(spec)) {
+		unsigned int nargs = pf.spec_to_nargs.at(spec);
+
+		token->str = spec;
+		token->args.resize(nargs);
+		/* Not printf conversion: don't fold it's argument */
+		if (!std_spec || (cs.pos == 0 && cs.parsed != spec.length())) {
+			cs = conv_spec_t();
+			cs.width = cs.prec = -1;
+			return spec.length();
+		}
+		if (nargs != conv_nargs(cs)) {
+			log::warn << "\t\tHandler for `%" << spec << "' takes "
+				<< nargs << " argument(s), but "
+				<< conv_nargs(cs) << " expected\n";
+			return 0;
+		}
+		return cs.parsed;
+	}
+
+	if (!std_spec)
+		return 0;
+
+	token->str = "~" + cs.len + cs.conv;
+	token->args.resize(conv_nargs(cs));
+	token->fmt_args = true;
+	if (pf.spec_to_func.find(token->str) == pf.spec_to_func.end())
+		token->str.clear();
+
+	return cs.parsed;
+}
+
+/*
+ * Maps specifier to printf-like call arguments: sequential specifiers
+ * take next arguments, positional `%n$' ones may refer any argument,
+ * even one, that was already printed. Mixing them is not allowed.
+ */
+static bool token_set_args(token_t *token, const printfun::printfun_t &pf,
+		unsigned int *arg, int *positional)
+{
+	const conv_spec_t &cs = token->cs;
+	bool is_pos = (cs.pos != 0);
+	size_t i = 0;
+
+	if (*positional >= 0 && *positional != is_pos) {
+		log::warn << "\t\tMixed positional and sequential arguments\n";
+		return false;
+	}
+	*positional = is_pos;
+
+	if (!is_pos) {
+		if (cs.width_pos != 0 || cs.prec_pos != 0)
+			return false;
+		for (i = 0; i < token->args.size(); i++)
+			token->args[i] = ++(*arg);
+		return true;
+	}
+
+	if ((cs.width_arg && cs.width_pos == 0) ||
+			(cs.prec_arg && cs.prec_pos == 0))
+		return false;
+	if (cs.width_arg)
+		token->args[i++] = pf.fmt_pos + cs.width_pos;
+	if (cs.prec_arg)
+		token->args[i++] = pf.fmt_pos + cs.prec_pos;
+	token->args[i] = pf.fmt_pos + cs.pos;
+
+	return true;
+}
+
+static std::vector<token_t>
+tokens_create(const char *fmt, const printfun::printfun_t &pf,
+		gcall *stmt)
 {
-	std::vector<std::pair<std::string, bool>> ret;
-	std::string token;
-	/* Do we have %s-function? */
+	std::vector<token_t> ret;
+	std::string literal;
+	unsigned int arg = pf.fmt_pos;
+	int positional = -1; /* unknown until the first specifier */
+	/* Binary records take any printf conversion */
+	bool binary = pf.spec_to_func.find("b") != pf.spec_to_func.end();
+	/* Do we have %s-function or vectored output? */
 	bool can_handle_strings =
-		specifier_search("s", pf).length();
+		(pf.spec_to_func.find("s") != pf.spec_to_func.end() &&
+		 !pf.spec_to_func.at("s").empty()) ||
+		pf.spec_to_func.find("v") != pf.spec_to_func.end() ||
+		pf.buffer || binary;
 
 	while (*fmt != '\0') {
+		token_t token = token_t();
+		conv_spec_t const_cs;
+		std::string folded;
+		size_t spec_len;
+
 		if (*fmt != '%') {
-			token += *fmt++;
+			literal += *fmt++;
 			if (!can_handle_strings)
 				goto ret_empty_str;
 			continue;
 		}
 		/* escaped '%' symbol */
 		if (*(fmt + 1) == '%') {
-			token += '%';
+			literal += '%';
 			fmt += 2;
 			if (!can_handle_strings)
 				goto ret_empty_str;
 			continue;
 		}
 		fmt++;
-		if (token.length()) {
-			ret.push_back(std::make_pair(token,false));
-			token.clear();
+		spec_len = token_spec_search(fmt, pf, &token);
+		if (spec_len == 0) {
+			log::warn << "\t\tCan't parse specifier: `"
+				<< "%" << fmt << "'\n";
+			goto ret_empty_str;
+		}
+		if (!token_set_args(&token, pf, &arg, &positional) ||
+				*std::max_element(token.args.begin(),
+					token.args.end()) >=
+				gimple_call_num_args(stmt)) {
+			log::warn << "\t\tNo argument for specifier `%"
+				<< std::string(fmt, spec_len) << "'\n";
+			goto ret_empty_str;
 		}
-		token = specifier_search(fmt, pf);
-		if (token.length() == 0) {
+
+		/* Merge constant arguments with neighbour literals */
+		const_cs = token.cs;
+		if (const_cs.conv != '\0' && can_handle_strings &&
+				conv_resolve_const_args(&const_cs, stmt,
+					token.args) &&
+				fold_const_arg(const_cs, gimple_call_arg(stmt,
+						token.args.back()), &folded)) {
+			log::debug << "\t\tFolding constant `%"
+				<< std::string(fmt, spec_len)
+				<< "' argument `" << folded
+				<< "' into format\n";
+			literal += folded;
+			fmt += spec_len;
+			continue;
+		}
+
+		if (binary && token.cs.conv != '\0')
+			token.str = token.cs.len + token.cs.conv;
+		if (token.str.length() == 0) {
 			log::warn << "\t\tThis specifier wasn't defined in plugin parameters: `"
 				<< "%" << fmt << "'\n";
 			goto ret_empty_str;
 		}
-		ret.push_back(std::make_pair(token,true));
-		fmt += token.length();
-		token.clear();
-	}
+		fmt += spec_len;
 
-	if (token.length()) {
-		if (!can_handle_strings)
-			goto ret_empty_str;
-		ret.push_back(std::make_pair(token,false));
+		if (literal.length()) {
+			ret.push_back({literal, false,
+					std::vector<unsigned int>(), false,
+					conv_spec_t()});
+			literal.clear();
+		}
+		ret.push_back(token);
 	}
+
+	if (literal.length())
+		ret.push_back({literal, false, std::vector<unsigned int>(),
+				false, conv_spec_t()});
 	return ret;
 
 ret_empty_str:
-	return std::vector<std::pair<std::string,bool>>();
+	return std::vector<token_t>();
 }
 
+static bool token_resolve_handler(const printfun::printfun_t &pf,
+		gimple_stmt_iterator *gsi, gcall *stmt, token_t *token);
 static void insert_spec_func(printfun::printfun_t &pf,
 		gcall *printf_stmt, gimple_stmt_iterator *gsi,
-		size_t cur_spec, std::pair<std::string, bool> token);
-
-static void handle_printfunc(gimple_stmt_iterator *gsi,
+		const token_t &token, tree lhs, bool cursor);
+static void insert_vec_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		std::vector<token_t> &tokens);
+static void insert_cursor_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		std::vector<token_t> &tokens);
+static bool buffer_func_bounded(printfun::printfun_t &pf,
+		const std::vector<token_t> &tokens);
+static void insert_buffer_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		std::vector<token_t> &tokens);
+static void insert_count_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		std::vector<token_t> &tokens);
+static bool tokens_max_len(const std::vector<token_t> &tokens,
+		size_t *out);
+static std::vector<gimple_stmt_iterator>
+sinkable_arg_computations(printfun::printfun_t &pf, gcall *printf_stmt,
+		gimple_stmt_iterator *gsi);
+static void sink_arg_computations(gimple_stmt_iterator *gsi,
+		std::vector<gimple_stmt_iterator> &sunk);
+static void insert_guard_begin(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi, tree l_off);
+static void insert_ratelimit_begin(const printfun::ratelimit_t &rl,
+		gimple_stmt_iterator *gsi, tree l_off);
+static void insert_profile_hit(gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		const char *fmt, const std::vector<token_t> &tokens);
+static void insert_guard_end(gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		tree l_off);
+static void insert_reserve_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi, size_t max_len);
+static bool tokens_bin_kinds(const std::vector<token_t> &tokens,
+		gcall *printf_stmt, std::string *kinds);
+static void tokens_unlock(printfun::printfun_t &pf,
+		std::vector<token_t> &tokens);
+static void insert_lock_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		const char *spec);
+static void insert_bin_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		const std::vector<token_t> &tokens, const std::string &kinds);
+static void tokens_split_chars(const printfun::printfun_t &pf,
+		std::vector<token_t> &tokens);
+static bool is_outlined_fn(tree decl);
+static bool site_is_cold(gimple_stmt_iterator *gsi);
+static bool vec_slot_size(const token_t &token, size_t *out);
+static bool insert_outlined_call(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi, bool pending);
+
+static bool handle_printfunc(gimple_stmt_iterator *gsi,
 		struct walk_stmt_info *wi, gcall *stmt,
 		const char *func_name, tree const_fmt)
 {
 	const char *fmt = TREE_STRING_POINTER(const_fmt);
-	std::vector<std::pair<std::string, bool>> tokens;
+	std::vector<token_t> tokens;
 	gimple *g = gsi_stmt(*gsi);
 	printfun::printfun_t &pf = printfun::printfuns.at(func_name);
+	const printfun::ratelimit_t *rl;
+	tree l_off = NULL_TREE;
+	bool binary = pf.spec_to_func.find("b") != pf.spec_to_func.end();
+	bool outlined = is_outlined_fn(current_function_decl);
+	bool lock = false, outline = false, pending = false;
+	std::string kinds;
 
 	log::info << "\t\tTrying to handle `" << func_name << "' call";
 	if (gimple_has_location(g))
@@ -262,197 +899,2594 @@ static void handle_printfunc(gimple_stmt_iterator *gsi,
 			<< ":" << gimple_lineno(g);
 	log::info << std::endl;
 
-	tokens = tokens_create(fmt, pf);
+	tokens = tokens_create(fmt, pf, stmt);
 	if (tokens.size() == 0) {
 		if (gimple_has_location(g))
 			log::warn << "\t\tIgnoring format string at:"
 				<< gimple_filename(g) << ":"
 				<< gimple_lineno(g) << "\n";
-		return;
+		return false;
 	}
 	log::debug << "\t\tTokens from format string: ";
-	for (std::vector<std::pair<std::string, bool>>::iterator i =
+	for (std::vector<token_t>::iterator i =
 			tokens.begin(); i != tokens.end(); ++i) {
-		if (i->second)
-			log::debug << "%" << i->first << ", ";
+		if (i->spec)
+			log::debug << "%" << i->str << ", ";
 		else
-			log::debug << "`" << (*i).first << "', ";
+			log::debug << "`" << i->str << "', ";
 	}
 	log::debug << std::endl;
 
-	size_t specs = 0;
-	for (size_t i = 0; i < tokens.size(); ++i) {
-		if (tokens[i].second)
-			specs++;
-		insert_spec_func(pf, stmt, gsi, specs, tokens[i]);
+	if (gimple_call_lhs(stmt) != NULL_TREE && !pf.buffer && !pf.count) {
+		log::warn << "\t\tReturn value is used, but handlers don't return bytes count\n";
+		return false;
+	}
+
+	if (binary && !tokens_bin_kinds(tokens, stmt, &kinds))
+		return false;
+
+	for (size_t i = 0; !binary && i < tokens.size(); ++i) {
+		if (tokens[i].spec &&
+				!token_resolve_handler(pf, gsi, stmt, &tokens[i])) {
+			log::warn << "\t\tNo `%" << tokens[i].str
+				<< "' handler for argument type\n";
+			return false;
+		}
+	}
+
+	/* Literals go to iovec, record or stores there */
+	if (!binary && !pf.buffer &&
+			pf.spec_to_func.find("v") == pf.spec_to_func.end())
+		tokens_split_chars(pf, tokens);
+	/* Vectored and binary output is one call for any tokens */
+	if (!binary && pf.spec_to_func.find("v") == pf.spec_to_func.end() &&
+			printfun::cost_model.max_tokens &&
+			tokens.size() > printfun::cost_model.max_tokens) {
+		log::info << "\t\t" << tokens.size()
+			<< " tokens cost more than the call, leaving it\n";
+		return false;
+	}
+
+	if (pf.spec_to_func.find("v") != pf.spec_to_func.end()) {
+		/* Scratch buffers are sized at compile time */
+		for (size_t i = 0; i < tokens.size(); ++i) {
+			size_t len;
+
+			if (tokens[i].fmt_args && (tokens[i].cs.width_arg ||
+						tokens[i].cs.prec_arg)) {
+				log::warn << "\t\tIgnoring `*' width or precision in vectored output\n";
+				return false;
+			}
+			if (tokens[i].spec && !vec_slot_size(tokens[i], &len)) {
+				log::warn << "\t\tCan't bound `%" << tokens[i].str
+					<< "' output for scratch buffer\n";
+				return false;
+			}
+		}
+	}
+
+	/* Nothing is emitted yet, so leaving the call is still possible */
+	if (pf.buffer && !buffer_func_bounded(pf, tokens)) {
+		log::warn << "\t\tCan't bound output length for sized buffer\n";
+		return false;
+	}
+
+	/* The call in outlined function is expanded when it's lowered */
+	if (!outlined) {
+		bool sized = printfun::cold_policy.action !=
+			printfun::cold_policy_t::EXPAND &&
+			tokens.size() > printfun::cold_policy.max_tokens;
+		bool cold = sized && site_is_cold(gsi);
+
+		if (cold && printfun::cold_policy.action ==
+				printfun::cold_policy_t::KEEP) {
+			log::info << "\t\tLeaving cold call site as is\n";
+			return false;
+		}
+		/*
+		 * Profile counts are read later, let them decide. The
+		 * instrumented build outlines the same sites, otherwise
+		 * CFG checksums don't match. AutoFDO skips IPA profile
+		 * pass, where they are decided, so it's no profile here.
+		 */
+		pending = sized && !cold && !printfun::outline_calls &&
+			(opt_for_fn(current_function_decl,
+				    flag_branch_probabilities) ||
+			 profile_arc_flag) && !flag_auto_profile;
+		outline = printfun::outline_calls || cold || pending;
+	}
+
+	/* Checks stay at the call site, where its arguments are known */
+	rl = outlined ? NULL : printfun::find_ratelimit(func_name);
+	if ((!outlined && !pf.guard.empty()) || rl != NULL) {
+		std::vector<gimple_stmt_iterator> sunk;
+
+		l_off = create_artificial_label(UNKNOWN_LOCATION);
+		sunk = sinkable_arg_computations(pf, stmt, gsi);
+		if (!pf.guard.empty())
+			insert_guard_begin(pf, stmt, gsi, l_off);
+		if (rl != NULL)
+			insert_ratelimit_begin(*rl, gsi, l_off);
+		sink_arg_computations(gsi, sunk);
+	}
+
+	if (outline && insert_outlined_call(pf, stmt, gsi, pending))
+		goto done;
+
+	/* One handler call takes the lock by itself */
+	if (pf.spec_to_func.find("[") != pf.spec_to_func.end() &&
+			tokens.size() > 1) {
+		lock = true;
+		tokens_unlock(pf, tokens);
+		insert_lock_func(pf, stmt, gsi, "[");
+	}
+
+	if (pf.spec_to_func.find("^") != pf.spec_to_func.end()) {
+		size_t max_len;
+
+		if (tokens_max_len(tokens, &max_len))
+			insert_reserve_func(pf, stmt, gsi, max_len);
+		else
+			log::debug << "\t\tOutput length is unbounded, not reserving\n";
+	}
+
+	if (pf.buffer) {
+		insert_buffer_func(pf, stmt, gsi, tokens);
+	} else if (binary) {
+		insert_bin_func(pf, stmt, gsi, tokens, kinds);
+	} else if (pf.spec_to_func.find("v") != pf.spec_to_func.end()) {
+		insert_vec_func(pf, stmt, gsi, tokens);
+	} else if (pf.spec_to_func.find("{") != pf.spec_to_func.end()) {
+		insert_cursor_func(pf, stmt, gsi, tokens);
+	} else if (pf.count) {
+		insert_count_func(pf, stmt, gsi, tokens);
+	} else {
+		for (size_t i = 0; i < tokens.size(); ++i)
+			insert_spec_func(pf, stmt, gsi, tokens[i],
+					NULL_TREE, false);
 	}
+done:
+	if (printfun::profile_sites && !outlined)
+		insert_profile_hit(stmt, gsi, fmt, tokens);
+	if (lock)
+		insert_lock_func(pf, stmt, gsi, "]");
+	if (l_off != NULL_TREE)
+		insert_guard_end(stmt, gsi, l_off);
 	gsi_remove(gsi, true);
+	/* gsi already points to the next statement, don't skip it */
+	wi->removed_stmt = true;
+	return true;
 }
 
-static void build_spec_function(printfun::printfun_t &pf,
-		gcall *printf_stmt, size_t cur_spec,
-		std::pair<std::string, bool> token)
+/*
+ * Handler declarations, built by plugin. Cached by name and signature
+ * and chained to GC root (with other cached trees), so they aren't
+ * collected between functions.
+ */
+static tree handler_decls = NULL_TREE;
+static std::map<std::pair<std::string, tree>, tree> handler_decl_cache;
+
+static const struct ggc_root_tab cprintf_ggc_roots[] = {
+	{ &handler_decls, 1, sizeof(handler_decls),
+		&gt_ggc_mx_tree_node, &gt_pch_nx_tree_node },
+	LAST_GGC_ROOT_TAB
+};
+
+void register_ggc_roots(const char *plugin_name)
 {
-	std::vector<tree> args;
-	tree fntype;
-	tree func_decl;
-	std::string func_name;
+	register_callback(plugin_name, PLUGIN_REGISTER_GGC_ROOTS,
+			NULL, (void *)cprintf_ggc_roots);
+}
 
-	for (unsigned int i = 0; i < pf.fmt_pos; ++i) {
-		tree arg_n = gimple_call_arg(printf_stmt, i);
-		args.push_back(TREE_TYPE(arg_n));
+/*
+ * Handler, defined in translation unit, i.e. static inline function
+ * from header: calling it instead of external declaration lets GCC
+ * inline handlers into the caller.
+ */
+static tree find_tu_function(const std::string &func_name)
+{
+	cgraph_node *node;
+
+	FOR_EACH_FUNCTION(node) {
+		tree decl = node->decl;
+
+		if (DECL_NAME(decl) != NULL_TREE &&
+				func_name == IDENTIFIER_POINTER(DECL_NAME(decl)))
+			return decl;
 	}
+	return NULL_TREE;
+}
 
-	if (token.second) {
-		tree spec_param = gimple_call_arg(printf_stmt,
-				pf.fmt_pos + cur_spec);
-		args.push_back(TREE_TYPE(spec_param));
-		func_name = pf.spec_to_func.at(token.first);
-	} else {
-		tree const_char_ptr_type_node =
-			build_pointer_type(build_type_variant(char_type_node, 1, 0));
-		if (token.first.length() <= prefer_puts &&
-				pf.spec_to_func.find("c") != pf.spec_to_func.end()) {
-			args.push_back(char_type_node);
-			func_name = pf.spec_to_func.at("c");
-		} else if (pf.spec_to_func.find("%") != pf.spec_to_func.end()) {
-			args.push_back(const_char_ptr_type_node);
-			args.push_back(size_type_node);
-			args.push_back(size_type_node);
-			func_name = pf.spec_to_func.at("%");
-		} else {
-			args.push_back(const_char_ptr_type_node);
-			func_name = pf.spec_to_func.at("s");
+/*
+ * TU function is found by name only, so its prototype may differ from
+ * what the call site passes. Arguments and result must be convertible
+ * without code; variadic functions are checked up to the ellipsis.
+ */
+static bool tu_function_matches(tree decl, tree fntype)
+{
+	tree tu_type = TREE_TYPE(decl);
+	tree tu_ret = TREE_TYPE(tu_type);
+	tree ret = TREE_TYPE(fntype);
+	tree p = TYPE_ARG_TYPES(tu_type);
+	tree a = TYPE_ARG_TYPES(fntype);
+
+	if (!prototype_p(tu_type))
+		return true;
+	if (!VOID_TYPE_P(ret) && !useless_type_conversion_p(ret, tu_ret))
+		return false;
+
+	for (; p != NULL_TREE && !VOID_TYPE_P(TREE_VALUE(p));
+			p = TREE_CHAIN(p), a = TREE_CHAIN(a)) {
+		if (a == NULL_TREE || VOID_TYPE_P(TREE_VALUE(a)))
+			return false;
+		if (!useless_type_conversion_p(TREE_VALUE(p), TREE_VALUE(a)))
+			return false;
+	}
+	/* More arguments than parameters are fine for `...' only */
+	return p == NULL_TREE || a == NULL_TREE || VOID_TYPE_P(TREE_VALUE(a));
+}
+
+/*
+ * Adapter for TU function with different, but convertible prototype,
+ * i.e. `unsigned int' parameter for `int' argument:
+ *	static inline ret cprintf_adapt.N(args...)
+ *	{
+ *		return (ret)func((param_type)args...);
+ *	}
+ * It's always inlined, so conversions are all what's left of it.
+ * Returns NULL_TREE if argument or result can't be converted.
+ */
+static tree build_adapter_fn(tree tu_decl, tree fntype)
+{
+	static unsigned int count;
+	tree tu_ret = TREE_TYPE(TREE_TYPE(tu_decl));
+	tree ret_type = TREE_TYPE(fntype);
+	tree p = TYPE_ARG_TYPES(TREE_TYPE(tu_decl));
+	tree params = NULL_TREE, *chain = &params;
+	tree decl, result, block, call, body;
+	std::vector<tree> args;
+	char name[32];
+
+	snprintf(name, sizeof(name), "cprintf_adapt.%u", count);
+	decl = build_fn_decl(name, fntype);
+
+	for (tree a = TYPE_ARG_TYPES(fntype); a != NULL_TREE &&
+			!VOID_TYPE_P(TREE_VALUE(a)); a = TREE_CHAIN(a)) {
+		tree parm = build_decl(UNKNOWN_LOCATION, PARM_DECL,
+				NULL_TREE, TREE_VALUE(a));
+		tree arg = parm;
+
+		DECL_ARG_TYPE(parm)	= TREE_VALUE(a);
+		DECL_ARTIFICIAL(parm)	= 1;
+		DECL_CONTEXT(parm)	= decl;
+		TREE_USED(parm)		= 1;
+		*chain = parm;
+		chain = &DECL_CHAIN(parm);
+
+		/* Past the ellipsis arguments go as they are */
+		if (p != NULL_TREE && !VOID_TYPE_P(TREE_VALUE(p))) {
+			if (!fold_convertible_p(TREE_VALUE(p), parm))
+				return NULL_TREE;
+			arg = fold_convert(TREE_VALUE(p), parm);
+			p = TREE_CHAIN(p);
+		} else if (p != NULL_TREE) {
+			return NULL_TREE;	/* too many arguments */
 		}
+		args.push_back(arg);
 	}
+	if (p != NULL_TREE && !VOID_TYPE_P(TREE_VALUE(p)))
+		return NULL_TREE;		/* too few arguments */
+	if (!VOID_TYPE_P(ret_type) && (VOID_TYPE_P(tu_ret) ||
+				!fold_convertible_p(ret_type,
+					build_zero_cst(tu_ret))))
+		return NULL_TREE;
+
+	TREE_PUBLIC(decl)		= 0;
+	DECL_EXTERNAL(decl)		= 0;
+	TREE_STATIC(decl)		= 1;
+	DECL_ARTIFICIAL(decl)		= 1;
+	DECL_IGNORED_P(decl)		= 1;
+	TREE_USED(decl)			= 1;
+	DECL_DECLARED_INLINE_P(decl)	= 1;
+	DECL_DISREGARD_INLINE_LIMITS(decl) = 1;
+	DECL_ATTRIBUTES(decl) = tree_cons(get_identifier("always_inline"),
+			NULL_TREE, NULL_TREE);
+	DECL_ARGUMENTS(decl) = params;
+
+	result = build_decl(UNKNOWN_LOCATION, RESULT_DECL, NULL_TREE,
+			ret_type);
+	DECL_ARTIFICIAL(result)		= 1;
+	DECL_IGNORED_P(result)		= 1;
+	DECL_CONTEXT(result)		= decl;
+	DECL_RESULT(decl)		= result;
+
+	call = build_call_array_loc(UNKNOWN_LOCATION, tu_ret,
+			build_fold_addr_expr(tu_decl), args.size(),
+			args.empty() ? NULL : &args[0]);
+	if (VOID_TYPE_P(ret_type))
+		body = call;
+	else
+		body = build1(RETURN_EXPR, void_type_node,
+				build2(MODIFY_EXPR, ret_type, result,
+					fold_convert(ret_type, call)));
+
+	block = make_node(BLOCK);
+	BLOCK_SUPERCONTEXT(block) = decl;
+	TREE_USED(block) = 1;
+	DECL_INITIAL(decl) = block;
+	DECL_SAVED_TREE(decl) = body;
+
+	/* Don't switch from the function, that is being lowered */
+	push_struct_function(decl);
+	pop_cfun();
+	cgraph_node::finalize_function(decl, true);
+	TREE_USED(tu_decl) = 1;
+	count++;
+
+	log::debug << "		Builded adapter `" << name << "' for `"
+		<< IDENTIFIER_POINTER(DECL_NAME(tu_decl)) << "'\n";
+	return decl;
+}
+
+static tree build_handler_decl(const std::string &func_name,
+		tree ret_type, std::vector<tree> &args)
+{
+	std::pair<std::string, tree> key;
+	tree fntype;
+	tree func_decl;
 
 	/*
-	 * Function return type is void for now.
 	 * &args[0] is contiguos array - that's guaranteed
 	 * now by C++ spec, 23.3.11
 	 */
-	fntype = build_function_type_array(void_type_node,
-			pf.fmt_pos + 1, &args[0]);
-	func_decl = build_fn_decl(func_name.c_str(), fntype);
-	if (token.second) {
-		pf.spec_to_tree[token.first] = func_decl;
-	} else {
-		if (token.first.length() <= prefer_puts &&
-				pf.spec_to_func.find("c") != pf.spec_to_func.end())
-			pf.spec_to_tree["c"] = func_decl;
-		else if (pf.spec_to_func.find("%") != pf.spec_to_func.end())
-			pf.spec_to_tree["%"] = func_decl;
+	fntype = build_function_type_array(ret_type,
+			args.size(), &args[0]);
+	/* Function types are hashed, so the same signature - same tree */
+	key = std::make_pair(func_name, fntype);
+	if (handler_decl_cache.find(key) != handler_decl_cache.end())
+		return handler_decl_cache.at(key);
+
+	func_decl = find_tu_function(func_name);
+	if (func_decl != NULL_TREE &&
+			!tu_function_matches(func_decl, fntype)) {
+		tree adapter = build_adapter_fn(func_decl, fntype);
+
+		/* The same symbol with other prototype is no way out */
+		if (adapter == NULL_TREE)
+			error("cprintf: prototype of %qs doesn't match "
+					"handler arguments", func_name.c_str());
 		else
-			pf.spec_to_tree["s"] = func_decl;
+			log::debug << "\t\tConverting arguments of `"
+				<< func_name << "' from translation unit\n";
+		func_decl = adapter;
+		if (func_decl != NULL_TREE) {
+			handler_decls = tree_cons(NULL_TREE, func_decl,
+					handler_decls);
+			handler_decl_cache[key] = func_decl;
+			return func_decl;
+		}
+	}
+	if (func_decl != NULL_TREE) {
+		TREE_USED(func_decl) = 1;
+		log::debug << "\t\tUsing `" << func_name
+			<< "' from translation unit\n";
+	} else {
+		func_decl = build_fn_decl(func_name.c_str(), fntype);
+		TREE_PUBLIC(func_decl)		= 1;
+		DECL_EXTERNAL(func_decl)	= 1;
+		DECL_ARTIFICIAL(func_decl)	= 1;
+		TREE_USED(func_decl)		= 1;
+		log::debug << "\t\tBuilded declaration for `" <<
+			func_name << "'\n";
 	}
-	TREE_PUBLIC(func_decl)		= 1;
-	DECL_EXTERNAL(func_decl)	= 1;
-	DECL_ARTIFICIAL(func_decl)	= 1;
-	TREE_USED(func_decl)		= 1;
-	log::debug << "\t\tBuilded declaration for `" <<
-		func_name << "'\n";
+
+	handler_decls = tree_cons(NULL_TREE, func_decl, handler_decls);
+	handler_decl_cache[key] = func_decl;
+	return func_decl;
 }
 
-static void insert_spec_func(printfun::printfun_t &pf,
-		gcall *printf_stmt, gimple_stmt_iterator *gsi,
-		size_t cur_spec, std::pair<std::string, bool> token)
+static tree overload_type_node(const std::string &type)
 {
-	tree spec_fn;
-	vec<tree> spec_args;
-	gimple *inserted;
+	if (type == "char")	return char_type_node;
+	if (type == "schar")	return signed_char_type_node;
+	if (type == "uchar")	return unsigned_char_type_node;
+	if (type == "short")	return short_integer_type_node;
+	if (type == "ushort")	return short_unsigned_type_node;
+	if (type == "int")	return integer_type_node;
+	if (type == "uint")	return unsigned_type_node;
+	if (type == "long")	return long_integer_type_node;
+	if (type == "ulong")	return long_unsigned_type_node;
+	if (type == "llong")	return long_long_integer_type_node;
+	if (type == "ullong")	return long_long_unsigned_type_node;
+	if (type == "double")	return double_type_node;
+	if (type == "ldouble")	return long_double_type_node;
+	return NULL_TREE; /* ptr and str match by pointer kind */
+}
 
-	if (gimple_call_num_args(printf_stmt) <= pf.fmt_pos)
-		/* Should never happen ;-) */
-		throw std::logic_error("Internal cprintf plugin error: number of arguments in printf-like function is larger than constant string fmt parameter\n");
+static bool overload_type_matches(const std::string &type, tree arg_type)
+{
+	tree t;
+
+	if (type == "ptr")
+		return POINTER_TYPE_P(arg_type);
+	if (type == "str") {
+		if (!POINTER_TYPE_P(arg_type))
+			return false;
+		t = TYPE_MAIN_VARIANT(TREE_TYPE(arg_type));
+		return t == char_type_node || t == signed_char_type_node ||
+			t == unsigned_char_type_node;
+	}
+	t = overload_type_node(type);
+	return t != NULL_TREE &&
+		TYPE_MAIN_VARIANT(arg_type) == TYPE_MAIN_VARIANT(t);
+}
 
-	if (token.second) {
-		/*
-		 * We checked that already while splitting
-		 * fmt string, but let's be cautious
-		 */
-		if (pf.spec_to_func.find(token.first) == pf.spec_to_func.end())
-			throw std::logic_error("Internal cprintf plugin error: found unknown specifier after splitting fmt string\n");
+/*
+ * Finds the value, which was converted to printf-like argument by
+ * default argument promotions right before the call, i.e. `s' for
+ *	D.1 = (int) s;
+ *	printf("%d", D.1);
+ */
+static tree find_narrowed_arg(gimple_stmt_iterator *gsi, tree arg)
+{
+	gimple_stmt_iterator i = *gsi;
+	std::vector<tree> assigned;
 
-		if (pf.spec_to_tree.find(token.first) == pf.spec_to_tree.end())
-			build_spec_function(pf, printf_stmt, cur_spec, token);
-		spec_fn = pf.spec_to_tree.at(token.first);
-	} else {
-		if (token.first.length() <= prefer_puts &&
-				pf.spec_to_func.find("c") != pf.spec_to_func.end()) {
-			if (pf.spec_to_tree.find("c") == pf.spec_to_tree.end())
-				build_spec_function(pf, printf_stmt,
-						cur_spec, token);
-			spec_fn = pf.spec_to_tree.at("c");
-		} else if (pf.spec_to_func.find("%") != pf.spec_to_func.end()) {
-			if (pf.spec_to_tree.find("%") == pf.spec_to_tree.end())
-				build_spec_function(pf, printf_stmt,
-						cur_spec, token);
-			spec_fn = pf.spec_to_tree.at("%");
-		} else {
-			if (pf.spec_to_func.find("s") == pf.spec_to_func.end())
-				throw std::logic_error("Internal cprintf plugin error: found constant string to print without %s-specifier handler\n");
-			if (pf.spec_to_tree.find("s") == pf.spec_to_tree.end())
-				build_spec_function(pf, printf_stmt,
-						cur_spec, token);
-			spec_fn = pf.spec_to_tree.at("s");
-		}
-	}
-
-	/* Don't handle multi-arg spec handlers for now */
-	spec_args.create(pf.fmt_pos + 1);
-	spec_args.safe_grow_cleared(pf.fmt_pos + 1);
-	for (unsigned int i = 0; i < pf.fmt_pos; ++i)
-		spec_args[i] = gimple_call_arg(printf_stmt, i);
-	if (token.second) {
-		/*
-		 * XXX: check for %s + const string parameter
-		 * and combine it with format-string + fwrite()
-		 */
-		unsigned token_arg = pf.fmt_pos + cur_spec;
-		spec_args[pf.fmt_pos] = gimple_call_arg(printf_stmt, token_arg);
-	} else {
-		/* XXX: handle prefer_puts > 1 */
-		if (token.first.length() <= prefer_puts &&
-				pf.spec_to_func.find("c") != pf.spec_to_func.end()) {
-			tree f = build_int_cst(char_type_node, token.first[0]);
-			spec_args[pf.fmt_pos] = f;
-		} else if (pf.spec_to_func.find("%") != pf.spec_to_func.end()) {
-			/* const char *ptr, size_t size, size_t nmemb */
-			spec_args.safe_grow_cleared(pf.fmt_pos + 3);
-			std::string &s = token.first;
-			tree fmt = build_string(s.length() + 1, s.c_str());
-			tree size = build_int_cst(size_type_node, 1);
-			tree nmemb = build_int_cst(size_type_node, s.length());
-			fmt = create_string_param(fmt);
-			spec_args[pf.fmt_pos] = fmt;
-			spec_args[pf.fmt_pos + 1] = size;
-			spec_args[pf.fmt_pos + 2] = nmemb;
-		} else {
-			std::string &s = token.first;
-			tree fmt_part = build_string(s.length() + 1, s.c_str());
-			fmt_part = create_string_param(fmt_part);
-			spec_args[pf.fmt_pos] = fmt_part;
-		}
-	}
-	inserted = gimple_build_call_vec(spec_fn, spec_args);
-	spec_args.release();
-	gsi_insert_before(gsi, inserted, GSI_SAME_STMT);
+	if (TREE_CODE(arg) != VAR_DECL || !DECL_ARTIFICIAL(arg))
+		return NULL_TREE;
 
-	log::info << "\t\tInserted call to `";
-	if (token.second) {
-		log::info << pf.spec_to_func.at(token.first);
-	} else {
-		if (token.first.length() <= prefer_puts &&
-				pf.spec_to_func.find("c") != pf.spec_to_func.end())
-			log::info << pf.spec_to_func.at("c");
-		else if (pf.spec_to_func.find("%") != pf.spec_to_func.end())
-			log::info << pf.spec_to_func.at("%");
-		else
-			log::info << pf.spec_to_func.at("s");
-		log::info << "(\"" << token.first << "\")";
+	for (gsi_prev(&i); !gsi_end_p(i); gsi_prev(&i)) {
+		gimple *g = gsi_stmt(i);
+		tree rhs;
+
+		if (!is_gimple_assign(g))
+			return NULL_TREE;
+		if (gimple_assign_lhs(g) != arg) {
+			assigned.push_back(gimple_assign_lhs(g));
+			continue;
+		}
+		if (!CONVERT_EXPR_CODE_P(gimple_assign_rhs_code(g)))
+			return NULL_TREE;
+		rhs = gimple_assign_rhs1(g);
+		if (!INTEGRAL_TYPE_P(TREE_TYPE(rhs)) ||
+				TYPE_PRECISION(TREE_TYPE(rhs)) >=
+				TYPE_PRECISION(TREE_TYPE(arg)))
+			return NULL_TREE;
+		/* Must still hold the same value at the call */
+		if (!is_gimple_reg(rhs) || std::find(assigned.begin(),
+					assigned.end(), rhs) != assigned.end())
+			return NULL_TREE;
+		return rhs;
 	}
-	log::info << "' function\n";
+	return NULL_TREE;
 }
 
-}; /* namespace gcc_hell */
-
+/*
+ * Picks handler for specifier by type of the value argument:
+ * constants go to the narrowest integer handler they fit, promoted
+ * values - to handler for their type before promotion, others - to
+ * handler for exact type or the narrowest integer one, wide enough.
+ * Untyped handler from plugin parameters is the fallback.
+ */
+static bool token_resolve_handler(const printfun::printfun_t &pf,
+		gimple_stmt_iterator *gsi, gcall *stmt, token_t *token)
+{
+	typedef std::vector<std::pair<std::string, std::string> > overloads_t;
+	std::map<std::string, overloads_t>::const_iterator ov;
+	tree arg = gimple_call_arg(stmt, token->args.back());
+	tree arg_type = TREE_TYPE(arg);
+	tree best_type = NULL_TREE;
+	tree narrow;
+	size_t best = 0;
+
+	token->func = pf.spec_to_func.at(token->str);
+	token->value = arg;
+	token->value_type = arg_type;
+
+	ov = pf.spec_to_overloads.find(token->str);
+	if (ov == pf.spec_to_overloads.end())
+		return !token->func.empty();
+	const overloads_t &o = ov->second;
+
+	if (TREE_CODE(arg) == INTEGER_CST) {
+		for (size_t i = 0; i < o.size(); i++) {
+			tree t = overload_type_node(o[i].first);
+
+			if (t == NULL_TREE || !INTEGRAL_TYPE_P(t) ||
+					!int_fits_type_p(arg, t))
+				continue;
+			if (best_type == NULL_TREE || TYPE_PRECISION(t) <
+					TYPE_PRECISION(best_type)) {
+				best = i;
+				best_type = t;
+			}
+		}
+		if (best_type != NULL_TREE)
+			token->value = fold_convert(best_type, arg);
+	}
+
+	narrow = find_narrowed_arg(gsi, arg);
+	for (size_t i = 0; best_type == NULL_TREE && narrow != NULL_TREE &&
+			i < o.size(); i++) {
+		if (!overload_type_matches(o[i].first, TREE_TYPE(narrow)))
+			continue;
+		best = i;
+		best_type = TREE_TYPE(narrow);
+		token->value = narrow;
+	}
+
+	for (size_t i = 0; best_type == NULL_TREE && i < o.size(); i++) {
+		if (!overload_type_matches(o[i].first, arg_type))
+			continue;
+		best = i;
+		best_type = arg_type;
+	}
+
+	if (best_type == NULL_TREE && INTEGRAL_TYPE_P(arg_type)) {
+		for (size_t i = 0; i < o.size(); i++) {
+			tree t = overload_type_node(o[i].first);
+
+			if (t == NULL_TREE || !INTEGRAL_TYPE_P(t) ||
+					TYPE_UNSIGNED(t) != TYPE_UNSIGNED(arg_type) ||
+					TYPE_PRECISION(t) < TYPE_PRECISION(arg_type))
+				continue;
+			if (best_type == NULL_TREE || TYPE_PRECISION(t) <
+					TYPE_PRECISION(best_type)) {
+				best = i;
+				best_type = t;
+			}
+		}
+	}
+
+	if (best_type == NULL_TREE)
+		return !token->func.empty();
+
+	token->func = o[best].second;
+	token->value_type = best_type;
+	log::debug << "\t\tUsing `" << token->func << "' for `%"
+		<< token->str << "' with " << o[best].first << " argument\n";
+	return true;
+}
+
+/* Number of decimal digits in the largest `bits'-wide value */
+static inline size_t dec_digits(unsigned int bits)
+{
+	return (bits * 30103UL + 99999) / 100000; /* log10(2) */
+}
+
+/*
+ * Upper bound of printf conversion output for value of given type.
+ * Returns false if it's unknown at compile time.
+ */
+static bool conv_max_len(const conv_spec_t &cs, tree type, size_t *out)
+{
+	bool ldouble = TYPE_MAIN_VARIANT(type) == long_double_type_node;
+	size_t prec = cs.prec < 0 ? 0 : cs.prec;
+	size_t exp_digits = ldouble ? 4 : 3;
+	unsigned int bits = TYPE_PRECISION(type);
+	size_t len;
+
+	if (cs.width_arg || cs.prec_arg)
+		return false;
+
+	switch (cs.conv) {
+	case 'd': case 'i': case 'u':
+	case 'o': case 'x': case 'X':
+		if (!INTEGRAL_TYPE_P(type))
+			return false;
+		if (cs.conv == 'o')
+			len = (bits + 2) / 3 + 1;	/* `#': leading 0 */
+		else if (cs.conv == 'x' || cs.conv == 'X')
+			len = (bits + 3) / 4 + 2;	/* `#': 0x */
+		else
+			len = dec_digits(bits);
+		len = std::max(len, prec) + 1;		/* sign */
+		break;
+	case 'c':
+		if (cs.len.length())
+			return false;			/* multibyte */
+		len = 1;
+		break;
+	case 's':
+		if (cs.prec < 0 || cs.len.length())
+			return false;
+		len = prec;
+		break;
+	case 'p':
+		len = std::max((size_t)POINTER_SIZE / 4 + 2,
+				sizeof("(nil)") - 1);
+		break;
+	case 'f': case 'F':
+		/* sign, integer part of DBL_MAX, point and fraction */
+		len = 1 + (ldouble ? 4933 : 309) + 1 +
+			(cs.prec < 0 ? 6 : prec);
+		break;
+	case 'e': case 'E':
+		/* -d.ddde+ddd */
+		len = 1 + 1 + 1 + (cs.prec < 0 ? 6 : prec) + 2 + exp_digits;
+		break;
+	case 'g': case 'G':
+		/* either %e or %f form with leading `0.000' */
+		prec = cs.prec < 0 ? 6 : std::max(prec, (size_t)1);
+		len = 1 + prec + std::max((size_t)5, 1 + 2 + exp_digits);
+		break;
+	case 'a': case 'A':
+		/* -0x1.hhhp+ddddd */
+		len = 1 + 4 + (cs.prec < 0 ? 16 : prec) + 2 + 5;
+		break;
+	case 'n':
+		len = 0;
+		break;
+	default:
+		return false;
+	}
+
+	*out = std::max(len, (size_t)std::max(cs.width, 0));
+	return true;
+}
+
+/*
+ * Upper bound of output length for the whole format string: literals
+ * are known, conversions are bounded by their type, width and
+ * precision. User-defined specifiers can't be bounded.
+ */
+static bool tokens_max_len(const std::vector<token_t> &tokens,
+		size_t *out)
+{
+	*out = 0;
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		size_t len;
+
+		if (!tokens[i].spec) {
+			*out += tokens[i].str.length();
+			continue;
+		}
+		/* Binary records don't resolve handlers and types */
+		if (tokens[i].cs.conv == '\0' ||
+				tokens[i].value_type == NULL_TREE ||
+				!conv_max_len(tokens[i].cs,
+					tokens[i].value_type, &len))
+			return false;
+		*out += len;
+	}
+	return true;
+}
+
+/* Value for specifier handler, converted to it's argument type */
+static tree token_value(gimple_stmt_iterator *gsi, const token_t &token)
+{
+	tree tmp;
+
+	if (useless_type_conversion_p(token.value_type,
+				TREE_TYPE(token.value)))
+		return token.value;
+	if (CONSTANT_CLASS_P(token.value))
+		return fold_convert(token.value_type, token.value);
+
+	tmp = create_tmp_var(token.value_type, "cprintf_val");
+	gsi_insert_before(gsi, gimple_build_assign(tmp, NOP_EXPR,
+				token.value), GSI_SAME_STMT);
+	return tmp;
+}
+
+/*
+ * `.*' precision as length limit: negative one is taken as omitted, so
+ * it becomes SIZE_MAX, i.e. (size_t)MAX_EXPR<prec, -1>.
+ */
+static tree prec_to_len(gimple_stmt_iterator *gsi, tree prec)
+{
+	tree type = TREE_TYPE(prec);
+	tree tmp, len;
+
+	if (TREE_CODE(prec) == INTEGER_CST)
+		return tree_int_cst_sgn(prec) < 0 ?
+			TYPE_MAX_VALUE(size_type_node) :
+			fold_convert(size_type_node, prec);
+
+	tmp = create_tmp_var(type, "cprintf_prec");
+	gsi_insert_before(gsi, gimple_build_assign(tmp, MAX_EXPR, prec,
+				build_int_cst(type, -1)), GSI_SAME_STMT);
+	len = create_tmp_var(size_type_node, "cprintf_len");
+	gsi_insert_before(gsi, gimple_build_assign(len, NOP_EXPR, tmp),
+			GSI_SAME_STMT);
+	return len;
+}
+
+/*
+ * Pushes printf-like arguments for specifier handler. For `%~'-handlers
+ * flags, width and precision go first: either as constants or as
+ * `*'-arguments of the call. Multi-argument handlers of printf
+ * conversions get the value first, then `*' width and `.*' precision
+ * as size_t length: `%.*s' handler is putmem(str, len).
+ */
+static void push_spec_args(vec<tree> *args, gimple_stmt_iterator *gsi,
+		gcall *printf_stmt, const token_t &token)
+{
+	const conv_spec_t &cs = token.cs;
+	size_t arg = 0;
+
+	if (!token.fmt_args && (cs.width_arg || cs.prec_arg)) {
+		args->safe_push(token_value(gsi, token));
+		if (cs.width_arg)
+			args->safe_push(gimple_call_arg(printf_stmt,
+						token.args[arg++]));
+		if (cs.prec_arg)
+			args->safe_push(prec_to_len(gsi,
+					gimple_call_arg(printf_stmt,
+						token.args[arg])));
+		return;
+	}
+	if (!token.fmt_args) {
+		for (size_t i = 0; i + 1 < token.args.size(); ++i)
+			args->safe_push(gimple_call_arg(printf_stmt,
+						token.args[i]));
+		args->safe_push(token_value(gsi, token));
+		return;
+	}
+
+	args->safe_push(build_int_cst(unsigned_type_node, cs.flags));
+	if (cs.width_arg)
+		args->safe_push(gimple_call_arg(printf_stmt,
+					token.args[arg++]));
+	else
+		args->safe_push(build_int_cst(integer_type_node, cs.width));
+	if (cs.prec_arg)
+		args->safe_push(gimple_call_arg(printf_stmt,
+					token.args[arg++]));
+	else
+		args->safe_push(build_int_cst(integer_type_node, cs.prec));
+	args->safe_push(token_value(gsi, token));
+}
+
+static inline bool has_handler(const printfun::printfun_t &pf,
+		const char *spec)
+{
+	return pf.spec_to_func.find(spec) != pf.spec_to_func.end() &&
+		!pf.spec_to_func.at(spec).empty();
+}
+
+/*
+ * Specifier to print literal part of format string with, by cost
+ * model: `%c' for single chars (longer literals up to char_max are
+ * split into them), `%%' (fwrite-like) from sized_min chars or `%s'.
+ */
+static std::string literal_spec(const printfun::printfun_t &pf,
+		const std::string &literal)
+{
+	const printfun::cost_model_t &cost = printfun::cost_model;
+
+	if (literal.length() == 1 && cost.char_max >= 1 &&
+			has_handler(pf, "c"))
+		return "c";
+	if (pf.spec_to_func.find("%") != pf.spec_to_func.end() &&
+			(literal.length() >= cost.sized_min ||
+			 !has_handler(pf, "s")))
+		return "%";
+	if (!has_handler(pf, "s"))
+		throw std::logic_error("Internal cprintf plugin error: found constant string to print without %s-specifier handler\n");
+	return "s";
+}
+
+/* Splits literals up to char_max chars into %c calls */
+static void tokens_split_chars(const printfun::printfun_t &pf,
+		std::vector<token_t> &tokens)
+{
+	std::vector<token_t> ret;
+
+	if (!has_handler(pf, "c"))
+		return;
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		const token_t &t = tokens[i];
+
+		if (t.spec || t.str.length() < 2 ||
+				t.str.length() > printfun::cost_model.char_max) {
+			ret.push_back(t);
+			continue;
+		}
+		for (size_t j = 0; j < t.str.length(); ++j) {
+			token_t c = t;
+
+			c.str = t.str.substr(j, 1);
+			ret.push_back(c);
+		}
+	}
+	tokens.swap(ret);
+}
+
+/* Pushes literal handler arguments and their types */
+static void push_literal_args(vec<tree> *args, std::vector<tree> *types,
+		const std::string &spec, const std::string &s)
+{
+	tree const_char_ptr_type_node =
+		build_pointer_type(build_type_variant(char_type_node, 1, 0));
+
+	if (spec == "c") {
+		args->safe_push(build_int_cst(char_type_node, s[0]));
+		types->push_back(char_type_node);
+	} else if (spec == "%") {
+		/* const char *ptr, size_t size, size_t nmemb */
+		tree fmt = build_string(s.length() + 1, s.c_str());
+
+		args->safe_push(create_string_param(fmt));
+		args->safe_push(build_int_cst(size_type_node, 1));
+		args->safe_push(build_int_cst(size_type_node, s.length()));
+		types->push_back(const_char_ptr_type_node);
+		types->push_back(size_type_node);
+		types->push_back(size_type_node);
+	} else {
+		tree fmt_part = build_string(s.length() + 1, s.c_str());
+
+		args->safe_push(create_string_param(fmt_part));
+		types->push_back(const_char_ptr_type_node);
+	}
+}
+
+/*
+ * Inserts handler call for token. Handlers take prefix arguments of
+ * printf-like function, or, in cursor mode, write cursor, which they
+ * return advanced past their output. Handler result goes to `lhs',
+ * if it's given.
+ */
+static void insert_spec_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		const token_t &token, tree lhs, bool cursor)
+{
+	std::vector<tree> types;
+	std::string func_name;
+	vec<tree> spec_args = vNULL;
+	tree ret_type = lhs ? TREE_TYPE(lhs) : void_type_node;
+	gcall *inserted;
+
+	if (gimple_call_num_args(printf_stmt) <= pf.fmt_pos)
+		/* Should never happen ;-) */
+		throw std::logic_error("Internal cprintf plugin error: number of arguments in printf-like function is larger than constant string fmt parameter\n");
+
+	if (cursor) {
+		spec_args.safe_push(lhs);
+		types.push_back(ret_type);
+	} else for (unsigned int i = 0; i < pf.fmt_pos; ++i) {
+		spec_args.safe_push(gimple_call_arg(printf_stmt, i));
+		types.push_back(TREE_TYPE(spec_args[i]));
+	}
+
+	if (token.spec) {
+		unsigned int first = spec_args.length();
+
+		func_name = token.func;
+		push_spec_args(&spec_args, gsi, printf_stmt, token);
+		for (unsigned int i = first; i < spec_args.length(); ++i)
+			types.push_back(TREE_TYPE(spec_args[i]));
+	} else {
+		std::string spec = literal_spec(pf, token.str);
+
+		/* Unless it was switched to unlocked variant */
+		func_name = token.func.empty() ?
+			pf.spec_to_func.at(spec) : token.func;
+		push_literal_args(&spec_args, &types, spec, token.str);
+	}
+
+	inserted = gimple_build_call_vec(build_handler_decl(func_name,
+				ret_type, types), spec_args);
+	spec_args.release();
+	if (lhs != NULL_TREE)
+		gimple_call_set_lhs(inserted, lhs);
+	gsi_insert_before(gsi, inserted, GSI_SAME_STMT);
+
+	log::info << "\t\tInserted call to `" << func_name;
+	if (!token.spec)
+		log::info << "(\"" << token.str << "\")";
+	log::info << "' function\n";
+}
+
+static tree build_iov_ref(tree iov, size_t idx)
+{
+	tree iov_type = TREE_TYPE(TREE_TYPE(iov));
+
+	return build4(ARRAY_REF, iov_type, iov, size_int(idx),
+			NULL_TREE, NULL_TREE);
+}
+
+/*
+ * struct iovec look-alike for vectored output mode:
+ * { void *iov_base; size_t iov_len; }
+ */
+static tree build_iovec_type(void)
+{
+	static tree type = NULL_TREE;
+	tree f_base, f_len;
+
+	if (type != NULL_TREE)
+		return type;
+
+	type = make_node(RECORD_TYPE);
+	f_base = build_decl(BUILTINS_LOCATION, FIELD_DECL,
+			get_identifier("iov_base"), ptr_type_node);
+	f_len = build_decl(BUILTINS_LOCATION, FIELD_DECL,
+			get_identifier("iov_len"), size_type_node);
+	/* finish_builtin_struct() takes fields chain in reverse order */
+	DECL_CHAIN(f_len) = f_base;
+	finish_builtin_struct(type, "cprintf_iovec", f_len, NULL_TREE);
+	handler_decls = tree_cons(NULL_TREE, type, handler_decls);
+
+	return type;
+}
+
+/*
+ * Scratch bytes for specifier slot in vectored output: enough for the
+ * conversion bound and terminating '\0'. Plain `%s' gets none, handler
+ * points the slot at the string itself. Returns false if the output
+ * can't be bounded.
+ */
+static bool vec_slot_size(const token_t &token, size_t *out)
+{
+	const conv_spec_t &cs = token.cs;
+
+	if (cs.conv == 's' && cs.width <= 0 && cs.prec < 0 &&
+			!cs.width_arg && !cs.prec_arg) {
+		*out = 0;
+		return true;
+	}
+	if (token.value_type == NULL_TREE ||
+			!conv_max_len(cs, token.value_type, out))
+		return false;
+	*out += 1;
+	return true;
+}
+
+/*
+ * Vectored output mode: literal parts of format string and parts,
+ * formatted by specifier handlers, are collected into on-stack iovec
+ * array, which is passed to %v-handler with the only call:
+ *	handler(prefix_args..., const struct iovec *iov, int iovcnt);
+ * Specifier handlers fill their slot, using scratch buffer if needed:
+ *	handler(struct iovec *slot, char *scratch, spec_arg);
+ */
+static void insert_vec_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		std::vector<token_t> &tokens)
+{
+	tree char_ptr_type_node = build_pointer_type(char_type_node);
+	tree iov_type = build_iovec_type();
+	tree f_base = TYPE_FIELDS(iov_type);
+	tree f_len = DECL_CHAIN(f_base);
+	tree iov, scratch = NULL_TREE;
+	std::vector<tree> types;
+	vec<tree> spec_args;
+	gimple *inserted;
+	size_t scratch_size = 0, scratch_off = 0;
+
+	/* Bounds were checked before anything was emitted */
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		size_t len = 0;
+
+		if (tokens[i].spec) {
+			bool bounded = vec_slot_size(tokens[i], &len);
+
+			gcc_assert(bounded);
+			scratch_size += len;
+		}
+	}
+
+	iov = create_tmp_var(build_array_type_nelts(iov_type,
+				tokens.size()), "cprintf_iov");
+	TREE_ADDRESSABLE(iov) = 1;
+	if (scratch_size) {
+		tree t = build_array_type_nelts(char_type_node, scratch_size);
+		scratch = create_tmp_var(t, "cprintf_scratch");
+		TREE_ADDRESSABLE(scratch) = 1;
+	}
+
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		std::string &s = tokens[i].str;
+
+		if (!tokens[i].spec) {
+			tree str = build_string(s.length() + 1, s.c_str());
+			tree len = build_int_cst(size_type_node, s.length());
+			tree ref;
+
+			ref = build3(COMPONENT_REF, ptr_type_node,
+					build_iov_ref(iov, i), f_base, NULL_TREE);
+			inserted = gimple_build_assign(ref,
+					create_string_param(str));
+			gsi_insert_before(gsi, inserted, GSI_SAME_STMT);
+
+			ref = build3(COMPONENT_REF, size_type_node,
+					build_iov_ref(iov, i), f_len, NULL_TREE);
+			inserted = gimple_build_assign(ref, len);
+			gsi_insert_before(gsi, inserted, GSI_SAME_STMT);
+			continue;
+		}
+
+		tree buf = null_pointer_node;
+		size_t len;
+
+		vec_slot_size(tokens[i], &len);
+		if (len) {
+			buf = build4(ARRAY_REF, char_type_node, scratch,
+					size_int(scratch_off),
+					NULL_TREE, NULL_TREE);
+			buf = build_fold_addr_expr_with_type(buf,
+					char_ptr_type_node);
+			scratch_off += len;
+		}
+
+		/* iovec slot to fill and scratch buffer for formatting */
+		spec_args.create(2 + tokens[i].args.size() + 1);
+		spec_args.quick_push(build_fold_addr_expr_with_type(
+				build_iov_ref(iov, i), ptr_type_node));
+		spec_args.quick_push(fold_convert(char_ptr_type_node, buf));
+		push_spec_args(&spec_args, gsi, printf_stmt, tokens[i]);
+		types.clear();
+		for (unsigned int j = 0; j < spec_args.length(); ++j)
+			types.push_back(TREE_TYPE(spec_args[j]));
+		inserted = gimple_build_call_vec(build_handler_decl(
+					tokens[i].func, void_type_node, types),
+				spec_args);
+		spec_args.release();
+		gsi_insert_before(gsi, inserted, GSI_SAME_STMT);
+	}
+
+	spec_args.create(pf.fmt_pos + 2);
+	types.clear();
+	for (unsigned int i = 0; i < pf.fmt_pos; ++i) {
+		spec_args.quick_push(gimple_call_arg(printf_stmt, i));
+		types.push_back(TREE_TYPE(spec_args[i]));
+	}
+	/* const struct iovec *iov, int iovcnt */
+	spec_args.quick_push(build_fold_addr_expr_with_type(iov,
+				const_ptr_type_node));
+	spec_args.quick_push(build_int_cst(integer_type_node,
+				tokens.size()));
+	types.push_back(const_ptr_type_node);
+	types.push_back(integer_type_node);
+	inserted = gimple_build_call_vec(build_handler_decl(
+				pf.spec_to_func.at("v"), pf.count ?
+				integer_type_node : void_type_node, types),
+			spec_args);
+	spec_args.release();
+	if (pf.count && gimple_call_lhs(printf_stmt) != NULL_TREE) {
+		tree ret = create_tmp_var(integer_type_node, "cprintf_ret");
+
+		gimple_call_set_lhs(as_a <gcall *>(inserted), ret);
+		gsi_insert_before(gsi, inserted, GSI_SAME_STMT);
+		insert_lhs_assign(gsi, gimple_call_lhs(printf_stmt), ret);
+	} else {
+		gsi_insert_before(gsi, inserted, GSI_SAME_STMT);
+	}
+
+	log::info << "\t\tInserted vectored call to `"
+		<< pf.spec_to_func.at("v") << "' with "
+		<< tokens.size() << " pieces\n";
+}
+
+/*
+ * Cursor output mode: handlers take write cursor into buffer, given
+ * by %{-hook, and return it advanced past their output; %}-hook
+ * gets the final cursor:
+ *	char *cur = begin(prefix_args...);
+ *	cur = handler(cur, spec_arg);
+ *	commit(prefix_args..., cur);
+ * With static inline handlers from header GCC may turn the whole
+ * line into plain stores.
+ */
+static void insert_cursor_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		std::vector<token_t> &tokens)
+{
+	tree char_ptr_type_node = build_pointer_type(char_type_node);
+	tree cursor = create_tmp_var(char_ptr_type_node, "cprintf_cur");
+	std::vector<tree> types;
+	vec<tree> args = vNULL;
+	gcall *call;
+
+	for (unsigned int i = 0; i < pf.fmt_pos; ++i) {
+		args.safe_push(gimple_call_arg(printf_stmt, i));
+		types.push_back(TREE_TYPE(args[i]));
+	}
+	call = gimple_build_call_vec(build_handler_decl(
+				pf.spec_to_func.at("{"), char_ptr_type_node,
+				types), args);
+	gimple_call_set_lhs(call, cursor);
+	gsi_insert_before(gsi, call, GSI_SAME_STMT);
+
+	for (size_t i = 0; i < tokens.size(); ++i)
+		insert_spec_func(pf, printf_stmt, gsi, tokens[i],
+				cursor, true);
+
+	args.safe_push(cursor);
+	types.push_back(char_ptr_type_node);
+	call = gimple_build_call_vec(build_handler_decl(
+				pf.spec_to_func.at("}"), void_type_node,
+				types), args);
+	args.release();
+	gsi_insert_before(gsi, call, GSI_SAME_STMT);
+
+	log::info << "\t\tInserted cursor calls between `"
+		<< pf.spec_to_func.at("{") << "' and `"
+		<< pf.spec_to_func.at("}") << "'\n";
+}
+
+/*
+ * Lets buffer-based handlers allocate space for the whole output
+ * at once, before printing anything:
+ *	reserve(prefix_args..., size_t max_len);
+ */
+static void insert_reserve_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi, size_t max_len)
+{
+	std::vector<tree> types;
+	vec<tree> args = vNULL;
+	gcall *call;
+
+	for (unsigned int i = 0; i < pf.fmt_pos; ++i) {
+		args.safe_push(gimple_call_arg(printf_stmt, i));
+		types.push_back(TREE_TYPE(args[i]));
+	}
+	args.safe_push(build_int_cst(size_type_node, max_len));
+	types.push_back(size_type_node);
+	call = gimple_build_call_vec(build_handler_decl(
+				pf.spec_to_func.at("^"), void_type_node,
+				types), args);
+	args.release();
+	gsi_insert_before(gsi, call, GSI_SAME_STMT);
+
+	log::info << "\t\tInserted call to `" << pf.spec_to_func.at("^")
+		<< "' reserving " << max_len << " bytes\n";
+}
+
+/*
+ * Lock bracket: %[ and %] hooks take prefix arguments and are called
+ * around the line (i.e. flockfile() and funlockfile() for fprintf()),
+ * handlers inside are switched to their unlocked variants.
+ */
+static const std::string &unlocked_func(const printfun::printfun_t &pf,
+		const std::string &func)
+{
+	std::map<std::string, std::string>::const_iterator it =
+		pf.unlocked.find(func);
+
+	return it == pf.unlocked.end() ? func : it->second;
+}
+
+static void tokens_unlock(printfun::printfun_t &pf,
+		std::vector<token_t> &tokens)
+{
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		token_t &t = tokens[i];
+
+		if (!t.spec)
+			t.func = pf.spec_to_func.at(literal_spec(pf, t.str));
+		t.func = unlocked_func(pf, t.func);
+	}
+}
+
+static void insert_lock_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		const char *spec)
+{
+	std::vector<tree> types;
+	vec<tree> args = vNULL;
+
+	for (unsigned int i = 0; i < pf.fmt_pos; ++i) {
+		args.safe_push(gimple_call_arg(printf_stmt, i));
+		types.push_back(TREE_TYPE(args[i]));
+	}
+	gsi_insert_before(gsi, gimple_build_call_vec(build_handler_decl(
+				pf.spec_to_func.at(spec), void_type_node,
+				types), args), GSI_SAME_STMT);
+	args.release();
+
+	log::info << "		Inserted call to `" << pf.spec_to_func.at(spec)
+		<< "' " << (spec[0] == '[' ? "locking" : "unlocking")
+		<< " the line\n";
+}
+
+/* Inserts `lhs = val' with conversion to lhs type */
+static void insert_lhs_assign(gimple_stmt_iterator *gsi, tree lhs, tree val)
+{
+	tree tmp = lhs;
+
+	/* Memory can be stored to only from register */
+	if (!is_gimple_reg(lhs))
+		tmp = create_tmp_var(TREE_TYPE(lhs), "cprintf_ret");
+	gsi_insert_before(gsi, gimple_build_assign(tmp, NOP_EXPR, val),
+			GSI_SAME_STMT);
+	if (tmp != lhs)
+		gsi_insert_before(gsi, gimple_build_assign(lhs, tmp),
+				GSI_SAME_STMT);
+}
+
+/* Inserts `len = end - start' for char pointers, returns len */
+static tree insert_ptr_diff(gimple_stmt_iterator *gsi, tree end, tree start)
+{
+	tree e = create_tmp_var(size_type_node, "cprintf_end");
+	tree b = create_tmp_var(size_type_node, "cprintf_start");
+	tree len = create_tmp_var(size_type_node, "cprintf_len");
+
+	gsi_insert_before(gsi, gimple_build_assign(e, NOP_EXPR, end),
+			GSI_SAME_STMT);
+	gsi_insert_before(gsi, gimple_build_assign(b, NOP_EXPR, start),
+			GSI_SAME_STMT);
+	gsi_insert_before(gsi, gimple_build_assign(len, MINUS_EXPR, e, b),
+			GSI_SAME_STMT);
+	return len;
+}
+
+/* Copies literal to the cursor with a store or memcpy() */
+static void insert_literal_store(gimple_stmt_iterator *gsi, tree cursor,
+		const std::string &s)
+{
+	gimple *g;
+
+	if (s.length() <= printfun::cost_model.store_max) {
+		/* Immediate stores, GCC may merge them */
+		for (size_t i = 0; i < s.length(); ++i) {
+			tree ref = build2(MEM_REF, char_type_node, cursor,
+					build_int_cst(TREE_TYPE(cursor), i));
+
+			g = gimple_build_assign(ref,
+					build_int_cst(char_type_node, s[i]));
+			gsi_insert_before(gsi, g, GSI_SAME_STMT);
+		}
+	} else {
+		tree str = build_string(s.length() + 1, s.c_str());
+
+		g = gimple_build_call(builtin_decl_explicit(BUILT_IN_MEMCPY),
+				3, cursor, create_string_param(str),
+				build_int_cst(size_type_node, s.length()));
+		gsi_insert_before(gsi, g, GSI_SAME_STMT);
+	}
+	g = gimple_build_assign(cursor, POINTER_PLUS_EXPR, cursor,
+			size_int(s.length()));
+	gsi_insert_before(gsi, g, GSI_SAME_STMT);
+}
+
+/*
+ * snprintf() truncation: copies at most size - 1 bytes of output
+ * and terminates it, unless size is zero:
+ *	if (size != 0) {
+ *		n = MIN(len, size - 1);
+ *		__builtin_memcpy(buf, start, n);
+ *		end = buf + n;
+ *		*end = 0;
+ *	}
+ */
+static void insert_truncated_copy(gimple_stmt_iterator *gsi, tree buf,
+		tree size, tree start, tree len)
+{
+	tree char_ptr_type_node = build_pointer_type(char_type_node);
+	tree l_copy = create_artificial_label(UNKNOWN_LOCATION);
+	tree l_done = create_artificial_label(UNKNOWN_LOCATION);
+	tree sz = create_tmp_var(size_type_node, "cprintf_size");
+	tree n = create_tmp_var(size_type_node, "cprintf_n");
+	tree end = create_tmp_var(char_ptr_type_node, "cprintf_end");
+	gimple *g;
+
+	g = gimple_build_assign(sz, NOP_EXPR, size);
+	gsi_insert_before(gsi, g, GSI_SAME_STMT);
+	g = gimple_build_cond(NE_EXPR, sz, build_int_cst(size_type_node, 0),
+			l_copy, l_done);
+	gsi_insert_before(gsi, g, GSI_SAME_STMT);
+	gsi_insert_before(gsi, gimple_build_label(l_copy), GSI_SAME_STMT);
+
+	g = gimple_build_assign(n, MINUS_EXPR, sz,
+			build_int_cst(size_type_node, 1));
+	gsi_insert_before(gsi, g, GSI_SAME_STMT);
+	g = gimple_build_assign(n, MIN_EXPR, len, n);
+	gsi_insert_before(gsi, g, GSI_SAME_STMT);
+	g = gimple_build_call(builtin_decl_explicit(BUILT_IN_MEMCPY), 3,
+			buf, start, n);
+	gsi_insert_before(gsi, g, GSI_SAME_STMT);
+	g = gimple_build_assign(end, NOP_EXPR, buf);
+	gsi_insert_before(gsi, g, GSI_SAME_STMT);
+	g = gimple_build_assign(end, POINTER_PLUS_EXPR, end, n);
+	gsi_insert_before(gsi, g, GSI_SAME_STMT);
+	g = gimple_build_assign(build_simple_mem_ref(end),
+			build_int_cst(char_type_node, 0));
+	gsi_insert_before(gsi, g, GSI_SAME_STMT);
+
+	gsi_insert_before(gsi, gimple_build_label(l_done), GSI_SAME_STMT);
+}
+
+/*
+ * Buffer mode for sprintf()-like functions: the first argument is
+ * destination buffer, the second one (for snprintf()-like) is it's
+ * size. Literals are copied inline, specifier handlers take and
+ * return write cursor, like in cursor mode:
+ *	cur = buf;
+ *	__builtin_memcpy(cur, "fd:", 3);
+ *	cur = cur + 3;
+ *	cur = handler(cur, spec_arg);
+ *	*cur = 0;
+ *	ret = cur - buf;
+ * If buffer size isn't known to fit the output, it's formatted in
+ * on-stack buffer and copied with truncation, so output length
+ * should be bounded at compile time.
+ */
+/* Sized buffer needs output length bound to fit the scratch buffer */
+static bool buffer_func_bounded(printfun::printfun_t &pf,
+		const std::vector<token_t> &tokens)
+{
+	size_t max_len;
+
+	return pf.fmt_pos < 2 || tokens_max_len(tokens, &max_len);
+}
+
+static void insert_buffer_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		std::vector<token_t> &tokens)
+{
+	tree char_ptr_type_node = build_pointer_type(char_type_node);
+	tree buf = gimple_call_arg(printf_stmt, 0);
+	tree size = NULL_TREE, scratch = NULL_TREE;
+	tree lhs = gimple_call_lhs(printf_stmt);
+	tree start, cursor, len;
+	size_t max_len = 0;
+	bool bounded;
+
+	bounded = tokens_max_len(tokens, &max_len);
+	if (pf.fmt_pos > 1) {
+		size = gimple_call_arg(printf_stmt, 1);
+		gcc_assert(bounded);
+		if (TREE_CODE(size) != INTEGER_CST ||
+				!tree_fits_uhwi_p(size) ||
+				tree_to_uhwi(size) <= max_len) {
+			tree t = build_array_type_nelts(char_type_node,
+					max_len + 1);
+
+			scratch = create_tmp_var(t, "cprintf_buf");
+			TREE_ADDRESSABLE(scratch) = 1;
+		}
+	}
+
+	if (scratch != NULL_TREE)
+		start = build_fold_addr_expr_with_type(scratch,
+				char_ptr_type_node);
+	else
+		start = buf;
+	cursor = create_tmp_var(char_ptr_type_node, "cprintf_cur");
+	gsi_insert_before(gsi, gimple_build_assign(cursor, NOP_EXPR, start),
+			GSI_SAME_STMT);
+
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		if (tokens[i].spec)
+			insert_spec_func(pf, printf_stmt, gsi, tokens[i],
+					cursor, true);
+		else
+			insert_literal_store(gsi, cursor, tokens[i].str);
+	}
+
+	len = insert_ptr_diff(gsi, cursor, start);
+	if (scratch == NULL_TREE)
+		gsi_insert_before(gsi, gimple_build_assign(
+					build_simple_mem_ref(cursor),
+					build_int_cst(char_type_node, 0)),
+				GSI_SAME_STMT);
+	else
+		insert_truncated_copy(gsi, buf, size, start, len);
+	if (lhs != NULL_TREE)
+		insert_lhs_assign(gsi, lhs, len);
+
+	log::info << "\t\tInserted buffer stores";
+	if (scratch != NULL_TREE)
+		log::info << " through " << max_len + 1 << " bytes buffer";
+	log::info << std::endl;
+}
+
+/*
+ * Counting mode: handlers return number of printed bytes or negative
+ * error, which stops printing and is returned from the call:
+ *	sum = 0;
+ *	r = handler(prefix_args..., spec_arg);
+ *	if (r < 0) goto err; else goto next;
+ * next:
+ *	sum = sum + r;
+ *	...
+ *	goto out;
+ * err:
+ *	sum = r;
+ * out:
+ *	ret = sum;
+ */
+static void insert_count_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		std::vector<token_t> &tokens)
+{
+	tree lhs = gimple_call_lhs(printf_stmt);
+	tree sum = create_tmp_var(integer_type_node, "cprintf_sum");
+	tree r = create_tmp_var(integer_type_node, "cprintf_r");
+	tree zero = build_int_cst(integer_type_node, 0);
+	tree l_err = create_artificial_label(UNKNOWN_LOCATION);
+	tree l_out = create_artificial_label(UNKNOWN_LOCATION);
+	gimple *g;
+
+	gsi_insert_before(gsi, gimple_build_assign(sum, zero), GSI_SAME_STMT);
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		tree l_next = create_artificial_label(UNKNOWN_LOCATION);
+
+		insert_spec_func(pf, printf_stmt, gsi, tokens[i], r, false);
+		g = gimple_build_cond(LT_EXPR, r, zero, l_err, l_next);
+		gsi_insert_before(gsi, g, GSI_SAME_STMT);
+		gsi_insert_before(gsi, gimple_build_label(l_next),
+				GSI_SAME_STMT);
+		g = gimple_build_assign(sum, PLUS_EXPR, sum, r);
+		gsi_insert_before(gsi, g, GSI_SAME_STMT);
+	}
+	gsi_insert_before(gsi, gimple_build_goto(l_out), GSI_SAME_STMT);
+	gsi_insert_before(gsi, gimple_build_label(l_err), GSI_SAME_STMT);
+	gsi_insert_before(gsi, gimple_build_assign(sum, r), GSI_SAME_STMT);
+	gsi_insert_before(gsi, gimple_build_label(l_out), GSI_SAME_STMT);
+	if (lhs != NULL_TREE)
+		insert_lhs_assign(gsi, lhs, sum);
+
+	log::info << "\t\tSumming up bytes count of " << tokens.size()
+		<< " handlers\n";
+}
+
+static tree collect_decl_op(tree *tp, int *walk_subtrees, void *data)
+{
+	std::vector<tree> *decls = (std::vector<tree> *)data;
+
+	if (TREE_CODE(*tp) == VAR_DECL)
+		decls->push_back(*tp);
+	return NULL_TREE;
+}
+
+static tree find_decl_op(tree *tp, int *walk_subtrees, void *data)
+{
+	struct walk_stmt_info *wi = (struct walk_stmt_info *)data;
+
+	return *tp == (tree)wi->info ? *tp : NULL_TREE;
+}
+
+/* Is decl referenced by statements after gsi? */
+static bool decl_used_after(gimple_stmt_iterator gsi, tree decl)
+{
+	struct walk_stmt_info wi;
+
+	for (gsi_next(&gsi); !gsi_end_p(gsi); gsi_next(&gsi)) {
+		memset(&wi, 0, sizeof(wi));
+		wi.info = decl;
+		if (walk_gimple_op(gsi_stmt(gsi), find_decl_op, &wi))
+			return true;
+	}
+	return false;
+}
+
+static inline bool decl_in(const std::vector<tree> &decls, tree decl)
+{
+	return std::find(decls.begin(), decls.end(), decl) != decls.end();
+}
+
+/*
+ * Finds computations of printf-like call arguments, which may be
+ * moved under the guard or rate limit check: side-effect free
+ * assignments to temporaries right before the call, which are used
+ * only by it's specifier arguments. Guard is pure and rate limit
+ * changes only it's own counters, so loads can't observe other memory
+ * after them. Returns them in reverse order.
+ */
+static std::vector<gimple_stmt_iterator>
+sinkable_arg_computations(printfun::printfun_t &pf, gcall *printf_stmt,
+		gimple_stmt_iterator *gsi)
+{
+	std::vector<gimple_stmt_iterator> ret;
+	std::vector<tree> prefix_used, used;
+	gimple_stmt_iterator i = *gsi;
+
+	for (unsigned int a = 0; a < gimple_call_num_args(printf_stmt); ++a)
+		walk_tree(gimple_call_arg_ptr(printf_stmt, a), collect_decl_op,
+				a < pf.fmt_pos ? &prefix_used : &used, NULL);
+
+	for (gsi_prev(&i); !gsi_end_p(i); gsi_prev(&i)) {
+		gimple *g = gsi_stmt(i);
+		tree lhs;
+
+		if (!is_gimple_assign(g) || gimple_has_side_effects(g))
+			break;
+		lhs = gimple_assign_lhs(g);
+		if (TREE_CODE(lhs) != VAR_DECL || !DECL_ARTIFICIAL(lhs) ||
+				!is_gimple_reg(lhs) || !decl_in(used, lhs) ||
+				decl_in(prefix_used, lhs) ||
+				decl_used_after(*gsi, lhs))
+			break;
+		for (unsigned int op = 1; op < gimple_num_ops(g); ++op)
+			walk_tree(gimple_op_ptr(g, op), collect_decl_op,
+					&used, NULL);
+		ret.push_back(i);
+	}
+	return ret;
+}
+
+static void sink_arg_computations(gimple_stmt_iterator *gsi,
+		std::vector<gimple_stmt_iterator> &sunk)
+{
+	for (size_t i = sunk.size(); i > 0; --i) {
+		gimple *g = gsi_stmt(sunk[i - 1]);
+
+		gsi_remove(&sunk[i - 1], false);
+		gsi_insert_before(gsi, g, GSI_SAME_STMT);
+	}
+	if (sunk.size())
+		log::debug << "\t\tMoved " << sunk.size()
+			<< " argument computations under the check\n";
+}
+
+/*
+ * Guarded printing: the whole sequence is executed only if guard
+ * on prefix arguments is true:
+ *	if (guard(prefix_args...) != 0) goto on; else goto off;
+ * on:
+ *	...arguments, which are side-effect free...
+ *	...handlers...
+ *	goto done;
+ * off:
+ *	ret = 0;
+ * done:
+ */
+static void insert_guard_begin(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi, tree l_off)
+{
+	tree l_on = create_artificial_label(UNKNOWN_LOCATION);
+	tree on = create_tmp_var(integer_type_node, "cprintf_on");
+	std::vector<tree> types;
+	vec<tree> args = vNULL;
+	tree decl;
+	gcall *call;
+	gimple *g;
+
+	for (unsigned int i = 0; i < pf.fmt_pos; ++i) {
+		args.safe_push(gimple_call_arg(printf_stmt, i));
+		types.push_back(TREE_TYPE(args[i]));
+	}
+	decl = build_handler_decl(pf.guard, integer_type_node, types);
+	/* Guard doesn't change memory, calls may be merged by GCC */
+	if (DECL_ARTIFICIAL(decl))
+		DECL_PURE_P(decl) = 1;
+	call = gimple_build_call_vec(decl, args);
+	args.release();
+	gimple_call_set_lhs(call, on);
+
+	gsi_insert_before(gsi, call, GSI_SAME_STMT);
+	g = gimple_build_cond(NE_EXPR, on, build_int_cst(integer_type_node, 0),
+			l_on, l_off);
+	gsi_insert_before(gsi, g, GSI_SAME_STMT);
+	gsi_insert_before(gsi, gimple_build_label(l_on), GSI_SAME_STMT);
+
+	log::info << "\t\tInserted guard `" << pf.guard << "'\n";
+}
+
+static void insert_guard_end(gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		tree l_off)
+{
+	tree lhs = gimple_call_lhs(printf_stmt);
+	tree l_done;
+
+	if (lhs == NULL_TREE) {
+		gsi_insert_before(gsi, gimple_build_label(l_off),
+				GSI_SAME_STMT);
+		return;
+	}
+
+	l_done = create_artificial_label(UNKNOWN_LOCATION);
+	gsi_insert_before(gsi, gimple_build_goto(l_done), GSI_SAME_STMT);
+	gsi_insert_before(gsi, gimple_build_label(l_off), GSI_SAME_STMT);
+	insert_lhs_assign(gsi, lhs, build_int_cst(TREE_TYPE(lhs), 0));
+	gsi_insert_before(gsi, gimple_build_label(l_done), GSI_SAME_STMT);
+}
+
+/* Zero-initialized static variable, private for call site */
+static tree build_site_var(tree type, const char *name)
+{
+	tree var = build_decl(UNKNOWN_LOCATION, VAR_DECL,
+			create_tmp_var_name(name), type);
+
+	TREE_STATIC(var)	= 1;
+	TREE_PUBLIC(var)	= 0;
+	TREE_USED(var)		= 1;
+	DECL_ARTIFICIAL(var)	= 1;
+	DECL_IGNORED_P(var)	= 1;
+	varpool_node::finalize_decl(var);
+
+	return var;
+}
+
+/*
+ * Rate limiting with per-site counters, checked before any argument
+ * is formatted. Counters aren't atomic: under contention a few extra
+ * lines may pass, which is fine for flood control.
+ * K/N prints K of every N calls:
+ *	c = cnt; cnt = c + 1;
+ *	if (c % N < K) goto pass; else goto off;
+ * N/s prints N calls per second:
+ *	now = time(0);
+ *	if (now != sec) { sec = now; cnt = 0; }
+ *	c = cnt;
+ *	if (c < N) goto pass; else goto off;
+ * pass:
+ *	cnt = c + 1;
+ */
+static void insert_ratelimit_begin(const printfun::ratelimit_t &rl,
+		gimple_stmt_iterator *gsi, tree l_off)
+{
+	tree cnt = build_site_var(unsigned_type_node, "cprintf_rl_cnt");
+	tree c = create_tmp_var(unsigned_type_node, "cprintf_rl_c");
+	tree c1 = create_tmp_var(unsigned_type_node, "cprintf_rl_c1");
+	tree l_pass = create_artificial_label(UNKNOWN_LOCATION);
+	gimple *g;
+
+	if (!rl.per_sec) {
+		tree r = create_tmp_var(unsigned_type_node, "cprintf_rl_r");
+
+		gsi_insert_before(gsi, gimple_build_assign(c, cnt),
+				GSI_SAME_STMT);
+		g = gimple_build_assign(c1, PLUS_EXPR, c,
+				build_int_cst(unsigned_type_node, 1));
+		gsi_insert_before(gsi, g, GSI_SAME_STMT);
+		gsi_insert_before(gsi, gimple_build_assign(cnt, c1),
+				GSI_SAME_STMT);
+		g = gimple_build_assign(r, TRUNC_MOD_EXPR, c,
+				build_int_cst(unsigned_type_node, rl.period));
+		gsi_insert_before(gsi, g, GSI_SAME_STMT);
+		g = gimple_build_cond(LT_EXPR, r,
+				build_int_cst(unsigned_type_node, rl.count),
+				l_pass, l_off);
+		gsi_insert_before(gsi, g, GSI_SAME_STMT);
+		gsi_insert_before(gsi, gimple_build_label(l_pass),
+				GSI_SAME_STMT);
+	} else {
+		tree sec = build_site_var(long_integer_type_node,
+				"cprintf_rl_sec");
+		tree now = create_tmp_var(long_integer_type_node,
+				"cprintf_rl_now");
+		tree last = create_tmp_var(long_integer_type_node,
+				"cprintf_rl_last");
+		tree l_reset = create_artificial_label(UNKNOWN_LOCATION);
+		tree l_check = create_artificial_label(UNKNOWN_LOCATION);
+		std::vector<tree> types(1, ptr_type_node);
+		gcall *call;
+
+		call = gimple_build_call(build_handler_decl("time",
+					long_integer_type_node, types), 1,
+				build_int_cst(ptr_type_node, 0));
+		gimple_call_set_lhs(call, now);
+		gsi_insert_before(gsi, call, GSI_SAME_STMT);
+		gsi_insert_before(gsi, gimple_build_assign(last, sec),
+				GSI_SAME_STMT);
+		g = gimple_build_cond(NE_EXPR, now, last, l_reset, l_check);
+		gsi_insert_before(gsi, g, GSI_SAME_STMT);
+
+		gsi_insert_before(gsi, gimple_build_label(l_reset),
+				GSI_SAME_STMT);
+		gsi_insert_before(gsi, gimple_build_assign(sec, now),
+				GSI_SAME_STMT);
+		gsi_insert_before(gsi, gimple_build_assign(cnt,
+					build_int_cst(unsigned_type_node, 0)),
+				GSI_SAME_STMT);
+
+		gsi_insert_before(gsi, gimple_build_label(l_check),
+				GSI_SAME_STMT);
+		gsi_insert_before(gsi, gimple_build_assign(c, cnt),
+				GSI_SAME_STMT);
+		g = gimple_build_cond(LT_EXPR, c,
+				build_int_cst(unsigned_type_node, rl.count),
+				l_pass, l_off);
+		gsi_insert_before(gsi, g, GSI_SAME_STMT);
+		gsi_insert_before(gsi, gimple_build_label(l_pass),
+				GSI_SAME_STMT);
+		g = gimple_build_assign(c1, PLUS_EXPR, c,
+				build_int_cst(unsigned_type_node, 1));
+		gsi_insert_before(gsi, g, GSI_SAME_STMT);
+		gsi_insert_before(gsi, gimple_build_assign(cnt, c1),
+				GSI_SAME_STMT);
+	}
+
+	log::info << "\t\tRate limited to " << rl.count << "/";
+	if (rl.per_sec)
+		log::info << "s\n";
+	else
+		log::info << rl.period << "\n";
+}
+
+/*
+ * Per-site profiler record, see rt/profile.c:
+ * struct cprintf_site {
+ *	const char	*file;
+ *	const char	*fmt;
+ *	unsigned int	line;
+ *	unsigned long	bound;	// max bytes per call, 0 if unknown
+ *	unsigned long	hits;
+ * };
+ */
+static tree build_site_type(void)
+{
+	static tree type = NULL_TREE;
+	tree const_char_ptr_type_node =
+		build_pointer_type(build_type_variant(char_type_node, 1, 0));
+	tree fields[5];
+
+	if (type != NULL_TREE)
+		return type;
+
+	fields[0] = build_decl(BUILTINS_LOCATION, FIELD_DECL,
+			get_identifier("file"), const_char_ptr_type_node);
+	fields[1] = build_decl(BUILTINS_LOCATION, FIELD_DECL,
+			get_identifier("fmt"), const_char_ptr_type_node);
+	fields[2] = build_decl(BUILTINS_LOCATION, FIELD_DECL,
+			get_identifier("line"), unsigned_type_node);
+	fields[3] = build_decl(BUILTINS_LOCATION, FIELD_DECL,
+			get_identifier("bound"), long_unsigned_type_node);
+	fields[4] = build_decl(BUILTINS_LOCATION, FIELD_DECL,
+			get_identifier("hits"), long_unsigned_type_node);
+	/* finish_builtin_struct() takes fields chain in reverse order */
+	for (int i = 4; i > 0; i--)
+		DECL_CHAIN(fields[i]) = fields[i - 1];
+
+	type = make_node(RECORD_TYPE);
+	finish_builtin_struct(type, "cprintf_site", fields[4], NULL_TREE);
+	/* Rooted with handler declarations */
+	handler_decls = tree_cons(NULL_TREE, type, handler_decls);
+	return type;
+}
+
+static tree build_string_ptr(const char *str)
+{
+	tree const_char_ptr_type_node =
+		build_pointer_type(build_type_variant(char_type_node, 1, 0));
+	tree s = build_string(strlen(str) + 1, str);
+
+	return fold_convert(const_char_ptr_type_node, create_string_param(s));
+}
+
+/*
+ * Static reference to cprintf_profile_dump(), once per translation
+ * unit: otherwise nothing pulls rt/profile.o out of the archive and
+ * it's constructor, that dumps profile, isn't linked in.
+ */
+static void build_profile_ref(void)
+{
+	static bool built = false;
+	std::vector<tree> types;
+	tree fn, ref;
+
+	if (built)
+		return;
+	built = true;
+
+	types.push_back(integer_type_node);
+	types.push_back(unsigned_type_node);
+	fn = build_handler_decl("cprintf_profile_dump", void_type_node,
+			types);
+
+	ref = build_decl(UNKNOWN_LOCATION, VAR_DECL,
+			create_tmp_var_name("cprintf_profile_ref"),
+			ptr_type_node);
+	TREE_STATIC(ref)	= 1;
+	TREE_PUBLIC(ref)	= 0;
+	TREE_USED(ref)		= 1;
+	TREE_READONLY(ref)	= 1;
+	DECL_ARTIFICIAL(ref)	= 1;
+	DECL_IGNORED_P(ref)	= 1;
+	DECL_PRESERVE_P(ref)	= 1;
+	DECL_INITIAL(ref) = fold_convert(ptr_type_node,
+			build_fold_addr_expr(fn));
+	varpool_node::finalize_decl(ref);
+	handler_decls = tree_cons(NULL_TREE, ref, handler_decls);
+}
+
+/*
+ * Profiler: every rewritten call site gets it's record in
+ * `cprintf_sites' section, which runtime finds by __start_ and
+ * __stop_ symbols (so the name has to be a C identifier) and dumps.
+ * Hits are counted without atomics: cheap, but approximate under
+ * contention.
+ */
+static void insert_profile_hit(gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		const char *fmt, const std::vector<token_t> &tokens)
+{
+	tree type = build_site_type();
+	tree f_file = TYPE_FIELDS(type);
+	tree f_fmt = DECL_CHAIN(f_file);
+	tree f_line = DECL_CHAIN(f_fmt);
+	tree f_bound = DECL_CHAIN(f_line);
+	tree f_hits = DECL_CHAIN(f_bound);
+	tree h = create_tmp_var(long_unsigned_type_node, "cprintf_hits");
+	vec<constructor_elt, va_gc> *init = NULL;
+	const char *file = "<unknown>";
+	unsigned int line = 0;
+	size_t bound = 0;
+	tree site, ref;
+	gimple *g;
+
+	if (gimple_has_location(printf_stmt)) {
+		file = gimple_filename(printf_stmt);
+		line = gimple_lineno(printf_stmt);
+	}
+	if (!tokens_max_len(tokens, &bound))
+		bound = 0;
+
+	site = build_decl(UNKNOWN_LOCATION, VAR_DECL,
+			create_tmp_var_name("cprintf_site"), type);
+	TREE_STATIC(site)	= 1;
+	TREE_PUBLIC(site)	= 0;
+	TREE_USED(site)		= 1;
+	DECL_ARTIFICIAL(site)	= 1;
+	DECL_IGNORED_P(site)	= 1;
+	DECL_PRESERVE_P(site)	= 1;
+	/* Records are an array in the section: no extra alignment */
+	SET_DECL_ALIGN(site, TYPE_ALIGN(type));
+	DECL_USER_ALIGN(site)	= 1;
+	set_decl_section_name(site, "cprintf_sites");
+
+	CONSTRUCTOR_APPEND_ELT(init, f_file, build_string_ptr(file));
+	CONSTRUCTOR_APPEND_ELT(init, f_fmt, build_string_ptr(fmt));
+	CONSTRUCTOR_APPEND_ELT(init, f_line,
+			build_int_cst(unsigned_type_node, line));
+	CONSTRUCTOR_APPEND_ELT(init, f_bound,
+			build_int_cst(long_unsigned_type_node, bound));
+	CONSTRUCTOR_APPEND_ELT(init, f_hits,
+			build_int_cst(long_unsigned_type_node, 0));
+	DECL_INITIAL(site) = build_constructor(type, init);
+	varpool_node::finalize_decl(site);
+	build_profile_ref();
+
+	ref = build3(COMPONENT_REF, long_unsigned_type_node, site, f_hits,
+			NULL_TREE);
+	gsi_insert_before(gsi, gimple_build_assign(h, ref), GSI_SAME_STMT);
+	g = gimple_build_assign(h, PLUS_EXPR, h,
+			build_int_cst(long_unsigned_type_node, 1));
+	gsi_insert_before(gsi, g, GSI_SAME_STMT);
+	ref = build3(COMPONENT_REF, long_unsigned_type_node, site, f_hits,
+			NULL_TREE);
+	gsi_insert_before(gsi, gimple_build_assign(ref, h), GSI_SAME_STMT);
+
+	log::debug << "\t\tProfiling site " << file << ":" << line << "\n";
+}
+
+/*
+ * Binary records mode: the call is replaced with one %b-handler call
+ *	handler(prefix_args..., const char *rec,
+ *			const unsigned long long *slots);
+ * which gets raw arguments in 8-byte slots and a record from
+ * `cprintf_fmt' section, that describes them: one kind per slot
+ * ('i' signed, 'u' unsigned integer, 'f' double, 's' string,
+ * 'p' pointer), NUL, format string without positions, NUL.
+ * Runtime stores slots with record offset in section as it's ID,
+ * format strings are taken from the binary by decoder.
+ */
+static char bin_kind(const conv_spec_t &cs)
+{
+	switch (cs.conv) {
+	case 'd': case 'i':
+		return 'i';
+	case 'o': case 'u': case 'x': case 'X':
+		return 'u';
+	case 'c':
+		return cs.len.empty() ? 'i' : '\0';
+	case 'e': case 'E': case 'f': case 'F':
+	case 'g': case 'G': case 'a': case 'A':
+		return (cs.len.empty() || cs.len == "l") ? 'f' : '\0';
+	case 's':
+		return cs.len.empty() ? 's' : '\0';
+	case 'p':
+		return 'p';
+	}
+	/* %n and %m can't be deferred */
+	return '\0';
+}
+
+static bool bin_kind_matches(char kind, tree type)
+{
+	if (kind == 'f')
+		return SCALAR_FLOAT_TYPE_P(type) &&
+			TYPE_PRECISION(type) <= TYPE_PRECISION(double_type_node);
+	if (kind == 's' || kind == 'p')
+		return POINTER_TYPE_P(type);
+	return INTEGRAL_TYPE_P(type) &&
+		TYPE_PRECISION(type) <= TYPE_PRECISION(
+				long_long_unsigned_type_node);
+}
+
+static bool tokens_bin_kinds(const std::vector<token_t> &tokens,
+		gcall *printf_stmt, std::string *kinds)
+{
+	kinds->clear();
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		const token_t &t = tokens[i];
+		char kind = bin_kind(t.cs);
+
+		if (!t.spec)
+			continue;
+		if (kind == '\0') {
+			log::warn << "\t\tCan't defer `%" << t.str
+				<< "' to binary record\n";
+			return false;
+		}
+		for (size_t j = 0; j < t.args.size(); ++j) {
+			char k = (j + 1 < t.args.size()) ? 'i' : kind;
+			tree arg = gimple_call_arg(printf_stmt, t.args[j]);
+
+			if (!bin_kind_matches(k, TREE_TYPE(arg))) {
+				log::warn << "\t\tArgument of `%" << t.str
+					<< "' doesn't fit binary record\n";
+				return false;
+			}
+			*kinds += k;
+		}
+	}
+	return true;
+}
+
+/* Format string for decoder: sequential arguments, escaped literals */
+static std::string tokens_bin_fmt(const std::vector<token_t> &tokens)
+{
+	std::string ret;
+
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		const token_t &t = tokens[i];
+
+		if (t.spec) {
+			ret += conv_spec_prefix(t.cs) + t.cs.len + t.cs.conv;
+			continue;
+		}
+		for (size_t j = 0; j < t.str.length(); ++j) {
+			if (t.str[j] == '%')
+				ret += '%';
+			ret += t.str[j];
+		}
+	}
+	return ret;
+}
+
+/* Records are shared by calls with the same format in compiled file */
+static std::map<std::string, tree> bin_records;
+
+static tree build_bin_record(const std::string &rec)
+{
+	std::map<std::string, tree>::iterator it = bin_records.find(rec);
+	tree type, str, decl;
+
+	if (it != bin_records.end())
+		return it->second;
+
+	type = build_array_type_nelts(char_type_node, rec.length());
+	str = build_string(rec.length(), rec.data());
+	TREE_TYPE(str) = type;
+	TREE_CONSTANT(str) = 1;
+	TREE_READONLY(str) = 1;
+	TREE_STATIC(str) = 1;
+
+	decl = build_decl(UNKNOWN_LOCATION, VAR_DECL,
+			create_tmp_var_name("cprintf_fmt"), type);
+	TREE_STATIC(decl)	= 1;
+	TREE_PUBLIC(decl)	= 0;
+	TREE_READONLY(decl)	= 1;
+	TREE_USED(decl)		= 1;
+	DECL_ARTIFICIAL(decl)	= 1;
+	DECL_IGNORED_P(decl)	= 1;
+	DECL_PRESERVE_P(decl)	= 1;
+	/* Records are packed back to back, decoder walks them */
+	SET_DECL_ALIGN(decl, BITS_PER_UNIT);
+	DECL_USER_ALIGN(decl)	= 1;
+	set_decl_section_name(decl, "cprintf_fmt");
+	DECL_INITIAL(decl) = str;
+	varpool_node::finalize_decl(decl);
+
+	/* Rooted with handler declarations */
+	handler_decls = tree_cons(NULL_TREE, decl, handler_decls);
+	bin_records[rec] = decl;
+	return decl;
+}
+
+/* Stores printf-like argument to slot: integers are extended to 64 bit */
+static void insert_bin_slot(gimple_stmt_iterator *gsi, tree slots,
+		size_t idx, char kind, tree arg)
+{
+	tree char_ptr_type_node = build_pointer_type(char_type_node);
+	tree type = kind == 'f' ? double_type_node :
+		long_long_unsigned_type_node;
+	tree ref, val;
+
+	if (kind == 'f')
+		ref = build2(MEM_REF, double_type_node,
+				build_fold_addr_expr(slots),
+				build_int_cst(char_ptr_type_node, idx * 8));
+	else
+		ref = build4(ARRAY_REF, long_long_unsigned_type_node, slots,
+				size_int(idx), NULL_TREE, NULL_TREE);
+
+	if (useless_type_conversion_p(type, TREE_TYPE(arg))) {
+		val = arg;
+	} else if (CONSTANT_CLASS_P(arg)) {
+		val = fold_convert(type, arg);
+	} else {
+		val = create_tmp_var(type, "cprintf_slot");
+		gsi_insert_before(gsi, gimple_build_assign(val,
+					kind == 'f' ? NOP_EXPR : CONVERT_EXPR,
+					arg), GSI_SAME_STMT);
+	}
+	gsi_insert_before(gsi, gimple_build_assign(ref, val), GSI_SAME_STMT);
+}
+
+static void insert_bin_func(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi,
+		const std::vector<token_t> &tokens, const std::string &kinds)
+{
+	tree const_char_ptr_type_node =
+		build_pointer_type(build_type_variant(char_type_node, 1, 0));
+	tree slots_ptr_type = build_pointer_type(build_type_variant(
+				long_long_unsigned_type_node, 1, 0));
+	std::string rec = kinds + '\0' + tokens_bin_fmt(tokens) + '\0';
+	tree decl = build_bin_record(rec);
+	tree slots = NULL_TREE;
+	std::vector<tree> types;
+	vec<tree> args;
+	size_t slot = 0;
+
+	if (kinds.length()) {
+		slots = create_tmp_var(build_array_type_nelts(
+					long_long_unsigned_type_node,
+					kinds.length()), "cprintf_slots");
+		TREE_ADDRESSABLE(slots) = 1;
+	}
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		if (!tokens[i].spec)
+			continue;
+		for (size_t j = 0; j < tokens[i].args.size(); ++j, ++slot)
+			insert_bin_slot(gsi, slots, slot, kinds[slot],
+					gimple_call_arg(printf_stmt,
+						tokens[i].args[j]));
+	}
+
+	args.create(pf.fmt_pos + 2);
+	for (unsigned int i = 0; i < pf.fmt_pos; ++i) {
+		args.quick_push(gimple_call_arg(printf_stmt, i));
+		types.push_back(TREE_TYPE(args[i]));
+	}
+	args.quick_push(build_fold_addr_expr_with_type(decl,
+				const_char_ptr_type_node));
+	args.quick_push(slots != NULL_TREE ?
+			build_fold_addr_expr_with_type(slots, slots_ptr_type) :
+			build_int_cst(slots_ptr_type, 0));
+	types.push_back(const_char_ptr_type_node);
+	types.push_back(slots_ptr_type);
+	gsi_insert_before(gsi, gimple_build_call_vec(build_handler_decl(
+				pf.spec_to_func.at("b"), void_type_node, types),
+			args), GSI_SAME_STMT);
+	args.release();
+
+	log::info << "\t\tInserted binary record call to `"
+		<< pf.spec_to_func.at("b") << "' with "
+		<< kinds.length() << " slots\n";
+}
+
+/*
+ * Batching (plugin argument `batch'): a run of calls to the same
+ * printf-like function with constant formats and the same prefix
+ * arguments, like multi-line dumps, is expanded as one call with joined
+ * format, so literals join across call boundary and reserve, lock and
+ * guard hooks are called once. The merged call is put after the last
+ * one and the run is removed only if it's expanded, otherwise calls are
+ * handled one by one. Between the calls there may be only computations
+ * of the next call arguments, that don't read memory: handlers of the
+ * previous calls could change it. Sites with rate limit or profiler
+ * counter, `%n' and positional arguments aren't merged.
+ */
+static bool fmt_has_n(const char *fmt)
+{
+	while ((fmt = strchr(fmt, '%')) != NULL) {
+		fmt++;
+		if (*fmt == '%') {
+			fmt++;
+			continue;
+		}
+		fmt += strspn(fmt, "-+ #0123456789.*hlLqjzt");
+		if (*fmt == 'n')
+			return true;
+	}
+	return false;
+}
+
+static bool batchable_call(gcall *stmt, tree fndecl, tree fmt)
+{
+	return stmt != NULL && fmt != NULL_TREE &&
+		gimple_call_fndecl(stmt) == fndecl &&
+		gimple_call_lhs(stmt) == NULL_TREE &&
+		!gimple_has_volatile_ops(stmt) &&
+		/* positional arguments aren't renumbered */
+		strchr(TREE_STRING_POINTER(fmt), '$') == NULL &&
+		!fmt_has_n(TREE_STRING_POINTER(fmt));
+}
+
+/* Operands are registers or constants */
+static bool reads_memory(gimple *g)
+{
+	for (unsigned int op = 1; op < gimple_num_ops(g); ++op) {
+		tree t = gimple_op(g, op);
+
+		if (t != NULL_TREE && !is_gimple_min_invariant(t) &&
+				!(DECL_P(t) && is_gimple_reg(t)))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Finds the next call of the run after *last, which can be merged with
+ * the first one; used are variables, referenced by the run arguments.
+ */
+static gcall *batch_next_call(printfun::printfun_t &pf, gcall *first,
+		const char *func_name, gimple_stmt_iterator *last,
+		std::vector<tree> *used)
+{
+	std::vector<gimple_stmt_iterator> between;
+	gimple_stmt_iterator i = *last;
+	size_t n = 0;
+	gcall *next;
+
+	for (gsi_next(&i); !gsi_end_p(i); gsi_next(&i), n++)
+		if (!is_gimple_assign(gsi_stmt(i)))
+			break;
+	if (gsi_end_p(i))
+		return NULL;
+	next = dyn_cast<gcall *>(gsi_stmt(i));
+	if (next == NULL || !batchable_call(next, gimple_call_fndecl(first),
+				printfun_get_const_fmt(next, func_name)))
+		return NULL;
+
+	for (unsigned int a = 0; a < pf.fmt_pos; ++a)
+		if (!operand_equal_p(gimple_call_arg(first, a),
+					gimple_call_arg(next, a), 0))
+			return NULL;
+
+	/* All statements between are computations of next arguments */
+	between = sinkable_arg_computations(pf, next, &i);
+	if (between.size() != n)
+		return NULL;
+	for (size_t j = 0; j < between.size(); ++j) {
+		gimple *g = gsi_stmt(between[j]);
+
+		if (decl_in(*used, gimple_assign_lhs(g)) || reads_memory(g))
+			return NULL;
+	}
+
+	for (unsigned int a = 0; a < gimple_call_num_args(next); ++a)
+		walk_tree(gimple_call_arg_ptr(next, a), collect_decl_op,
+				used, NULL);
+	*last = i;
+	return next;
+}
+
+static gcall *build_batch_call(printfun::printfun_t &pf,
+		const std::vector<gcall *> &run, const char *func_name)
+{
+	std::string joined;
+	vec<tree> args = vNULL;
+	gcall *merged;
+
+	for (size_t i = 0; i < run.size(); ++i)
+		joined += TREE_STRING_POINTER(
+				printfun_get_const_fmt(run[i], func_name));
+
+	for (unsigned int a = 0; a < pf.fmt_pos; ++a)
+		args.safe_push(gimple_call_arg(run[0], a));
+	args.safe_push(create_string_param(build_string(
+				joined.length() + 1, joined.c_str())));
+	for (size_t i = 0; i < run.size(); ++i)
+		for (unsigned int a = pf.fmt_pos + 1;
+				a < gimple_call_num_args(run[i]); ++a)
+			args.safe_push(gimple_call_arg(run[i], a));
+
+	merged = gimple_build_call_vec(gimple_call_fndecl(run[0]), args);
+	args.release();
+	gimple_set_location(merged, gimple_location(run[0]));
+	return merged;
+}
+
+/* Returns true, if the run from stmt is merged and expanded */
+static bool handle_printfunc_batch(gimple_stmt_iterator *gsi,
+		struct walk_stmt_info *wi, gcall *stmt, const char *func_name)
+{
+	printfun::printfun_t &pf = printfun::printfuns.at(func_name);
+	std::vector<gimple_stmt_iterator> run_gsi;
+	std::vector<gcall *> run;
+	std::vector<tree> used;
+	gimple_stmt_iterator last = *gsi;
+	gcall *next, *merged;
+
+	/* Buffer functions would overwrite each other's output */
+	if (pf.buffer || printfun::profile_sites ||
+			printfun::find_ratelimit(func_name) != NULL ||
+			!batchable_call(stmt, gimple_call_fndecl(stmt),
+				printfun_get_const_fmt(stmt, func_name)))
+		return false;
+
+	run.push_back(stmt);
+	run_gsi.push_back(*gsi);
+	for (unsigned int a = 0; a < gimple_call_num_args(stmt); ++a)
+		walk_tree(gimple_call_arg_ptr(stmt, a), collect_decl_op,
+				&used, NULL);
+	while ((next = batch_next_call(pf, stmt, func_name, &last,
+					&used)) != NULL) {
+		run.push_back(next);
+		run_gsi.push_back(last);
+	}
+	if (run.size() < 2)
+		return false;
+
+	merged = build_batch_call(pf, run, func_name);
+	gsi_insert_after(&last, merged, GSI_NEW_STMT);
+	log::info << "\t\tBatching " << run.size() << " `" << func_name
+		<< "' calls into one\n";
+	if (!handle_printfunc(&last, wi, merged, func_name,
+				printfun_get_const_fmt(merged, func_name))) {
+		gsi_remove(&last, true);
+		wi->removed_stmt = false;
+		log::info << "\t\tBatched call isn't expanded, leaving calls apart\n";
+		return false;
+	}
+
+	/* last points after the expansion, where walk continues */
+	for (size_t i = 0; i < run_gsi.size(); ++i)
+		gsi_remove(&run_gsi[i], true);
+	*gsi = last;
+	wi->removed_stmt = true;
+	return true;
+}
+
+/*
+ * Outlining: expansion takes place in a static cold noinline function
+ *	ret cprintf_outlined.N(prefix_args..., args...)
+ *	{
+ *		return printfun(prefix_args..., "fmt", args...);
+ *	}
+ * and the call site becomes a direct call of it without format,
+ * constant arguments and varargs. Guard, rate limit and profiler hit
+ * stay at the call site. Functions are shared by call sites with the
+ * same format, constants and argument types in translation unit. The
+ * body is gimplified and lowered by GCC, when it reaches the function:
+ * then this pass expands the call inside, constants are folded there.
+ *
+ * With -fprofile-use call sites, which aren't cold by static hints, are
+ * pending: they call an inlinable function with inlining forbidden at
+ * the call, until the profile pass decides by the call site count.
+ */
+static std::map<std::string, tree> outlined_fns;
+
+/* Original call: arguments of the outlined call fill NULL_TREE gaps */
+struct pending_fn_t {
+	tree					callee;
+	std::vector<tree>			args;
+};
+static std::map<tree, pending_fn_t> pending_fns;
+
+static bool is_outlined_fn(tree decl)
+{
+	std::map<std::string, tree>::const_iterator it;
+
+	for (it = outlined_fns.begin(); it != outlined_fns.end(); ++it)
+		if (it->second == decl)
+			return true;
+	return false;
+}
+
+static tree build_outlined_fn(gcall *printf_stmt,
+		const std::vector<tree> &tmpl, const std::vector<tree> &types,
+		bool pending)
+{
+	tree callee = gimple_call_fndecl(printf_stmt);
+	tree ret_type = TREE_TYPE(TREE_TYPE(callee));
+	tree decl, result, block, call, body;
+	tree params = NULL_TREE, *chain = &params;
+	std::vector<tree> args;
+	char name[32];
+
+	snprintf(name, sizeof(name), "cprintf_outlined.%zu",
+			outlined_fns.size());
+	decl = build_fn_decl(name, build_function_type_array(ret_type,
+				types.size(), types.empty() ? NULL :
+				const_cast<tree *>(&types[0])));
+	TREE_PUBLIC(decl)		= 0;
+	DECL_EXTERNAL(decl)		= 0;
+	TREE_STATIC(decl)		= 1;
+	DECL_ARTIFICIAL(decl)		= 1;
+	DECL_IGNORED_P(decl)		= 1;
+	TREE_USED(decl)			= 1;
+	TREE_NOTHROW(decl)		= TREE_NOTHROW(callee);
+	if (pending) {
+		DECL_DECLARED_INLINE_P(decl) = 1;
+	} else {
+		DECL_UNINLINABLE(decl) = 1;
+		DECL_ATTRIBUTES(decl) = tree_cons(get_identifier("cold"),
+				NULL_TREE, tree_cons(get_identifier("noinline"),
+					NULL_TREE, NULL_TREE));
+	}
+
+	result = build_decl(UNKNOWN_LOCATION, RESULT_DECL, NULL_TREE,
+			ret_type);
+	DECL_ARTIFICIAL(result)		= 1;
+	DECL_IGNORED_P(result)		= 1;
+	DECL_CONTEXT(result)		= decl;
+	DECL_RESULT(decl)		= result;
+
+	for (size_t i = 0, n = 0; i < tmpl.size(); ++i) {
+		tree parm;
+
+		if (tmpl[i] != NULL_TREE) {
+			args.push_back(unshare_expr(tmpl[i]));
+			continue;
+		}
+		parm = build_decl(UNKNOWN_LOCATION, PARM_DECL, NULL_TREE,
+				types[n]);
+		DECL_ARG_TYPE(parm)	= types[n++];
+		DECL_ARTIFICIAL(parm)	= 1;
+		DECL_CONTEXT(parm)	= decl;
+		TREE_USED(parm)		= 1;
+		*chain = parm;
+		chain = &DECL_CHAIN(parm);
+		args.push_back(parm);
+	}
+	DECL_ARGUMENTS(decl) = params;
+
+	call = build_call_array_loc(gimple_location(printf_stmt), ret_type,
+			build_fold_addr_expr(callee), args.size(), &args[0]);
+	if (VOID_TYPE_P(ret_type))
+		body = call;
+	else
+		body = build1(RETURN_EXPR, void_type_node,
+				build2(MODIFY_EXPR, ret_type, result, call));
+
+	block = make_node(BLOCK);
+	BLOCK_SUPERCONTEXT(block) = decl;
+	TREE_USED(block) = 1;
+	DECL_INITIAL(decl) = block;
+	DECL_SAVED_TREE(decl) = body;
+
+	/* Don't switch from the function, that is being lowered */
+	push_struct_function(decl);
+	pop_cfun();
+	/* No GC: trees of current function aren't rooted */
+	cgraph_node::finalize_function(decl, true);
+
+	log::debug << "\t\tBuilded outlined function `" << name << "'\n";
+	return decl;
+}
+
+/*
+ * Constant is a part of outlined function, if call sites can share it by
+ * value: integer or string literal.
+ */
+static bool outline_const_key(tree arg, std::string *key)
+{
+	char buf[48];
+	tree str;
+
+	if (TREE_CODE(arg) == INTEGER_CST && tree_fits_shwi_p(arg)) {
+		snprintf(buf, sizeof(buf), ",%u=%lld",
+				TYPE_UID(TYPE_MAIN_VARIANT(TREE_TYPE(arg))),
+				(long long)tree_to_shwi(arg));
+		*key += buf;
+		return true;
+	}
+	str = TREE_CODE(arg) == ADDR_EXPR ? TREE_OPERAND(arg, 0) : NULL_TREE;
+	if (str != NULL_TREE && TREE_CODE(str) == ARRAY_REF &&
+			integer_zerop(TREE_OPERAND(str, 1)))
+		str = TREE_OPERAND(str, 0);
+	if (str != NULL_TREE && TREE_CODE(str) == STRING_CST) {
+		snprintf(buf, sizeof(buf), ",%u=\"%d:",
+				TYPE_UID(TYPE_MAIN_VARIANT(TREE_TYPE(arg))),
+				TREE_STRING_LENGTH(str));
+		*key += buf;
+		key->append(TREE_STRING_POINTER(str), TREE_STRING_LENGTH(str));
+		return true;
+	}
+	return false;
+}
+
+static bool insert_outlined_call(printfun::printfun_t &pf,
+		gcall *printf_stmt, gimple_stmt_iterator *gsi, bool pending)
+{
+	tree fmt_arg = gimple_call_arg(printf_stmt, pf.fmt_pos);
+	std::string key(get_name(gimple_call_fndecl(printf_stmt)));
+	std::map<std::string, tree>::iterator it;
+	std::vector<tree> types, tmpl;
+	vec<tree> args = vNULL;
+	tree decl;
+	gcall *call;
+
+	if (pending)
+		key += "pending";
+	key += '\0';
+	key += TREE_STRING_POINTER(get_string_cst(fmt_arg));
+	for (unsigned int i = 0; i < gimple_call_num_args(printf_stmt); ++i) {
+		tree arg = gimple_call_arg(printf_stmt, i);
+		char uid[16];
+
+		if (i == pf.fmt_pos) {
+			tmpl.push_back(fmt_arg);
+			continue;
+		}
+		if (outline_const_key(arg, &key)) {
+			tmpl.push_back(arg);
+			continue;
+		}
+		/* Only scalars are passed to handlers */
+		if (!is_gimple_reg_type(TREE_TYPE(arg))) {
+			args.release();
+			return false;
+		}
+		tmpl.push_back(NULL_TREE);
+		types.push_back(TYPE_MAIN_VARIANT(TREE_TYPE(arg)));
+		args.safe_push(arg);
+		snprintf(uid, sizeof(uid), ",%u", TYPE_UID(types.back()));
+		key += uid;
+	}
+
+	it = outlined_fns.find(key);
+	if (it != outlined_fns.end()) {
+		decl = it->second;
+	} else {
+		decl = build_outlined_fn(printf_stmt, tmpl, types, pending);
+		handler_decls = tree_cons(NULL_TREE, decl, handler_decls);
+		outlined_fns[key] = decl;
+		if (pending) {
+			pending_fn_t &p = pending_fns[decl];
+
+			p.callee = gimple_call_fndecl(printf_stmt);
+			p.args = tmpl;
+		}
+		/* Constants of the body are referenced by the original call */
+		for (size_t i = 0; i < tmpl.size(); ++i)
+			if (tmpl[i] != NULL_TREE)
+				handler_decls = tree_cons(NULL_TREE, tmpl[i],
+						handler_decls);
+	}
+
+	call = gimple_build_call_vec(decl, args);
+	args.release();
+	gimple_call_set_lhs(call, gimple_call_lhs(printf_stmt));
+	gimple_set_location(call, gimple_location(printf_stmt));
+	if (pending)
+		gimple_call_set_cannot_inline(call, true);
+	gsi_insert_before(gsi, call, GSI_SAME_STMT);
+
+	log::info << "\t\tCall is " << (pending ? "pending in `" :
+			"outlined to `")
+		<< IDENTIFIER_POINTER(DECL_NAME(decl)) << "'\n";
+	return true;
+}
+
+bool pending_fns_exist(void)
+{
+	return !pending_fns.empty();
+}
+
+/*
+ * Profile pass: pending call site in hot block may be inlined by IPA
+ * inliner within usual limits for `inline' function, i.e. its expansion
+ * ends up in place; in cold one it stays outlined or gets the original
+ * call back. Counts are estimated, if there's no profile.
+ */
+static bool resolve_pending_call(function *fun, gimple_stmt_iterator *gsi,
+		gcall *call)
+{
+	tree decl = gimple_call_fndecl(call);
+	std::map<tree, pending_fn_t>::const_iterator it;
+	vec<tree> args = vNULL;
+	gcall *orig;
+
+	if (decl == NULL_TREE || !gimple_call_cannot_inline_p(call))
+		return false;
+	it = pending_fns.find(decl);
+	if (it == pending_fns.end())
+		return false;
+
+	if (maybe_hot_bb_p(fun, gimple_bb(call))) {
+		/* Only this edge: cold calls of the function stay out */
+		gimple_call_set_cannot_inline(call, false);
+		log::info << "\t\tHot call site, inlining `"
+			<< IDENTIFIER_POINTER(DECL_NAME(decl)) << "'\n";
+		return true;
+	}
+	if (printfun::cold_policy.action == printfun::cold_policy_t::OUTLINE) {
+		log::info << "\t\tCold call site, `"
+			<< IDENTIFIER_POINTER(DECL_NAME(decl))
+			<< "' stays outlined\n";
+		return false;
+	}
+
+	for (size_t i = 0, n = 0; i < it->second.args.size(); ++i)
+		args.safe_push(it->second.args[i] != NULL_TREE ?
+				unshare_expr(it->second.args[i]) :
+				gimple_call_arg(call, n++));
+
+	orig = gimple_build_call_vec(it->second.callee, args);
+	args.release();
+	gimple_call_set_lhs(orig, gimple_call_lhs(call));
+	gimple_set_location(orig, gimple_location(call));
+	gimple_set_vuse(orig, gimple_vuse(call));
+	gimple_set_vdef(orig, gimple_vdef(call));
+	if (gimple_vdef(orig) != NULL_TREE &&
+			TREE_CODE(gimple_vdef(orig)) == SSA_NAME)
+		SSA_NAME_DEF_STMT(gimple_vdef(orig)) = orig;
+	gsi_replace(gsi, orig, true);
+
+	log::info << "\t\tLeaving cold call site as is\n";
+	return true;
+}
+
+/*
+ * Call site hotness. GCC reads profile counts after CFG is built, so
+ * before it only static hints are known: the function is cold by
+ * attribute, the call is after cold label or `[[unlikely]]', or it's in
+ * branch, unlikely by __builtin_expect(). Other sites are decided by
+ * the profile pass, if there are counts.
+ */
+static bool label_is_unlikely(gimple_seq seq, tree label)
+{
+	gimple *prev = NULL;
+
+	for (gimple_stmt_iterator i = gsi_start(seq); !gsi_end_p(i);
+			prev = gsi_stmt(i), gsi_next(&i)) {
+		gcond *cond = dyn_cast<gcond *>(gsi_stmt(i));
+		enum tree_code code;
+		bool true_likely;
+		tree expected;
+
+		if (cond == NULL || prev == NULL ||
+				(gimple_cond_true_label(cond) != label &&
+				 gimple_cond_false_label(cond) != label))
+			continue;
+		code = gimple_cond_code(cond);
+		if (!gimple_call_builtin_p(prev, BUILT_IN_EXPECT) ||
+				gimple_call_lhs(prev) != gimple_cond_lhs(cond) ||
+				!integer_zerop(gimple_cond_rhs(cond)) ||
+				(code != NE_EXPR && code != EQ_EXPR))
+			return false;
+		expected = gimple_call_arg(prev, 1);
+		if (TREE_CODE(expected) != INTEGER_CST)
+			return false;
+
+		true_likely = (code == NE_EXPR) != integer_zerop(expected);
+		return gimple_cond_true_label(cond) == label ?
+			!true_likely : true_likely;
+	}
+	return false;
+}
+
+static bool site_is_cold(gimple_stmt_iterator *gsi)
+{
+	tree fn = current_function_decl;
+	gimple_stmt_iterator i = *gsi;
+
+	if (lookup_attribute("cold", DECL_ATTRIBUTES(fn)))
+		return true;
+	if (lookup_attribute("hot", DECL_ATTRIBUTES(fn)))
+		return false;
+
+	/* Straight-line code before the call */
+	for (gsi_prev(&i); !gsi_end_p(i); gsi_prev(&i)) {
+		gimple *g = gsi_stmt(i);
+
+		switch (gimple_code(g)) {
+		case GIMPLE_PREDICT:
+			if (gimple_predict_predictor(g) == PRED_COLD_LABEL &&
+					gimple_predict_outcome(g) == NOT_TAKEN)
+				return true;
+			break;
+		case GIMPLE_LABEL:
+			return label_is_unlikely(*gsi->seq,
+				gimple_label_label(as_a<glabel *>(g)));
+		case GIMPLE_COND:
+		case GIMPLE_GOTO:
+		case GIMPLE_SWITCH:
+		case GIMPLE_RETURN:
+			return false;
+		default:
+			break;
+		}
+	}
+	return false;
+}
+
+}; /* namespace gcc_hell */
@@ -3,13 +3,22 @@
 
 #include <gcc-plugin.h>
 #include <tree.h>
+#include <stringpool.h>
+#include <stor-layout.h>
 #include <tree-pass.h>
 #include <context.h>
+#include <ggc.h>
+#include <cgraph.h>
 #include <gimple.h>
 #include <gimple-iterator.h>
 #include <gimple-walk.h>
+#include <predict.h>
+#include <diagnostic-core.h>
 
 namespace gcc_hell {
+	void register_ggc_roots(const char *plugin_name);
+	bool pending_fns_exist(void);
+
 	struct cprintf_pass : gimple_opt_pass
 	{
 		cprintf_pass(gcc::context *ctx);
@@ -23,6 +32,18 @@ namespace gcc_hell {
 			bool *handled_all_ops, struct walk_stmt_info *wi);
 		static tree callback_op(tree *t, int *, void *data);
 	};
+
+	/* Runs after -fprofile-use counts are read */
+	struct cprintf_profile_pass : gimple_opt_pass
+	{
+		cprintf_profile_pass(gcc::context *ctx);
+		virtual bool gate(function *fun) override;
+		virtual unsigned int execute(function *fun) override;
+		virtual cprintf_profile_pass* clone() override
+		{
+			return this;
+		}
+	};
 }; /* namespace gcc_hell */
 
 #endif /* CPRINTF_GCC_HELL_H */
@@ -6,6 +6,13 @@
 namespace printfun {
 
 std::map<std::string, printfun_t> printfuns;
+std::vector<level_filter_t> level_filters;
+std::vector<ratelimit_t> ratelimits;
+bool profile_sites;
+bool outline_calls;
+bool batch_calls;
+cold_policy_t cold_policy = { cold_policy_t::EXPAND, 0 };
+cost_model_t cost_model = { 1, 0, 1, 0 };
 
 static const char *parse_get_fmt_pos(const char *printfun_def,
 		unsigned int *out, std::string &func)
@@ -62,6 +69,28 @@ static const char *parse_get_function(const char *printfun_def,
 	return printfun_def;
 }
 
+static const char *parse_get_nargs(const char *printfun_def,
+		unsigned int *out, std::string &func)
+{
+	size_t nargs_len;
+
+	*out = 1;
+	if (*printfun_def != '/')
+		return printfun_def;
+	printfun_def++;
+	try {
+		*out = std::stoul(printfun_def, &nargs_len, 10);
+	} catch(...) {
+		std::string err("Invalid number of arguments for `");
+		throw std::logic_error(err + func + "' handler");
+	}
+	if (*out == 0) {
+		std::string err("Handler `");
+		throw std::logic_error(err + func + "' should take arguments");
+	}
+	return printfun_def + nargs_len;
+}
+
 static const char *parse_get_specifier(const char *printfun_def,
 		std::string *out)
 {
@@ -88,6 +117,186 @@ static const char *parse_get_specifier(const char *printfun_def,
 	return printfun_def;
 }
 
+static const char *overload_types[] = {
+	"char", "schar", "uchar", "short", "ushort", "int", "uint",
+	"long", "ulong", "llong", "ullong", "double", "ldouble",
+	"ptr", "str",
+};
+
+bool is_reserved(const std::string &spec)
+{
+	return spec == "%" || spec == "v" || spec == "{" || spec == "}" ||
+		spec == "^" || spec == "b" || spec == "[" || spec == "]";
+}
+
+static inline bool has_spec(const printfun_t &pf, const char *spec)
+{
+	return pf.spec_to_func.find(spec) != pf.spec_to_func.end();
+}
+
+bool is_overload_type(const std::string &type)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(overload_types); i++)
+		if (type == overload_types[i])
+			return true;
+	return false;
+}
+
+/*
+ * Parses handlers for one specifier: `[type:]func[|unlocked][/nargs]'
+ * items up to the next %-specifier. Untyped one is the default handler.
+ */
+static const char *parse_get_handlers(const char *printfun_def,
+		printfun_t *pf, const std::string &spec)
+{
+	std::vector<std::pair<std::string, std::string> > overloads;
+	unsigned int i;
+
+	pf->spec_to_func[spec] = "";
+	for (i = 0;; i++) {
+		std::string type, func;
+		unsigned int nargs;
+
+		while (ISBLANK(*printfun_def)) printfun_def++;
+		if (*printfun_def == '\0' || *printfun_def == '%')
+			break;
+		printfun_def = parse_get_function(printfun_def, &func);
+		if (*printfun_def == ':') {
+			type = func;
+			func.clear();
+			if (!is_overload_type(type)) {
+				std::string err("Unknown argument type `");
+				err += type;
+				throw std::logic_error(err + "' for %" + spec);
+			}
+			printfun_def = parse_get_function(printfun_def + 1,
+					&func);
+		}
+		if (*printfun_def == '|') {
+			std::string alt;
+
+			printfun_def = parse_get_function(printfun_def + 1,
+					&alt);
+			if (pf->unlocked.find(func) != pf->unlocked.end() &&
+					pf->unlocked.at(func) != alt) {
+				std::string err("Handler `");
+				throw std::logic_error(err + func +
+					"' has two unlocked variants");
+			}
+			pf->unlocked[func] = alt;
+		}
+		printfun_def = parse_get_nargs(printfun_def, &nargs, func);
+		if (*printfun_def != '\0' && !ISBLANK(*printfun_def)) {
+			std::string err("Unexpected `");
+			err += *printfun_def;
+			throw std::logic_error(err + "' after `" + func + "'");
+		}
+
+		if (i > 0 && pf->spec_to_nargs[spec] != nargs) {
+			std::string err("Handler `");
+			err += func;
+			throw std::logic_error(err +
+				"' takes other number of arguments than %" +
+				spec + " handlers before");
+		}
+		pf->spec_to_nargs[spec] = nargs;
+
+		if (type.empty()) {
+			if (!pf->spec_to_func[spec].empty()) {
+				std::string err("Default handler for %");
+				throw std::logic_error(err + spec + " found twice");
+			}
+			pf->spec_to_func[spec] = func;
+			continue;
+		}
+		if (is_reserved(spec)) {
+			std::string err("Reserved %");
+			throw std::logic_error(err + spec +
+				" specifier can't have typed handlers");
+		}
+		for (size_t j = 0; j < overloads.size(); j++) {
+			if (overloads[j].first != type)
+				continue;
+			std::string err("Handler for `");
+			throw std::logic_error(err + type + "' argument of %" +
+				spec + " found twice");
+		}
+		overloads.push_back(std::make_pair(type, func));
+	}
+
+	if (i == 0) {
+		std::string err("No handler specified for %");
+		throw std::logic_error(err + spec);
+	}
+	if (!overloads.empty())
+		pf->spec_to_overloads[spec] = overloads;
+	return printfun_def;
+}
+
+/*
+ * Modes after format position:
+ * `>' marks sprintf()-like function, which prints to buffer from the
+ * first argument (of size from the second one for snprintf()-like);
+ * `+' marks handlers, returning printed bytes count or negative error;
+ * `?guard' is predicate on prefix arguments, which enables printing.
+ */
+static const char *parse_get_modes(const char *printfun_def,
+		printfun_t *pf, const std::string &func)
+{
+	pf->buffer = false;
+	pf->count = false;
+	pf->guard.clear();
+	for (;; printfun_def++) {
+		const char *guard = printfun_def;
+
+		while (ISBLANK(*guard)) guard++;
+		if (*guard == '?') {
+			if (!pf->guard.empty()) {
+				std::string err("Function `");
+				throw std::logic_error(err + func +
+					"' has more than one guard");
+			}
+			printfun_def = parse_get_function(guard + 1,
+					&pf->guard) - 1;
+		} else if (*printfun_def == '>') {
+			if (pf->fmt_pos != 1 && pf->fmt_pos != 2) {
+				std::string err("Buffer function `");
+				throw std::logic_error(err + func +
+					"' should have format at position 1 or 2");
+			}
+			pf->buffer = true;
+		} else if (*printfun_def == '+') {
+			pf->count = true;
+		} else {
+			break;
+		}
+	}
+	if (*printfun_def == '\0') {
+		std::string err("Unexpected line end after `");
+		throw std::logic_error(err + func + "' function");
+	}
+	if (pf->buffer && pf->count) {
+		std::string err("Buffer function `");
+		throw std::logic_error(err + func +
+			"' returns output length already");
+	}
+	if (pf->buffer && !pf->guard.empty()) {
+		std::string err("Buffer function `");
+		throw std::logic_error(err + func + "' can't have guard");
+	}
+	/* Skipped call would leave the buffer unterminated */
+	for (size_t i = 0; pf->buffer && i < ratelimits.size(); i++) {
+		if (ratelimits[i].func != func)
+			continue;
+		std::string err("Buffer function `");
+		throw std::logic_error(err + func + "' can't be rate limited");
+	}
+	if (!pf->guard.empty())
+		log::info << "Guard `" << pf->guard << "' for `"
+			<< func << "'\n";
+	return printfun_def;
+}
+
 void add_printfun(const char *printfun_def)
 {
 	printfun_t pf;
@@ -97,35 +306,103 @@ void add_printfun(const char *printfun_def)
 	printfun_def = parse_get_function(printfun_def, &fun_name);
 	printfun_def = parse_get_fmt_pos(printfun_def,
 			&pf.fmt_pos, fun_name);
+	printfun_def = parse_get_modes(printfun_def, &pf, fun_name);
 	printfun_def++; /* skip function delimiter */
 
 	for (i = 0;;i++) {
-		std::string spec, func;
+		std::string spec;
 
 		printfun_def = parse_get_specifier(printfun_def, &spec);
 		if (*printfun_def == '\0')
 			break;
-		printfun_def = parse_get_function(printfun_def, &func);
-		printfun_def++; /* skip function delimiter */
-
-		if (pf.spec_to_func.find(spec) != pf.spec_to_func.end()) {
+		if (pf.spec_to_nargs.find(spec) != pf.spec_to_nargs.end()) {
 			std::string err("%-Specifier `");
 			err += spec;
 			throw std::logic_error(err + "' found twice");
 		}
-		pf.spec_to_func[spec] = func;
+		printfun_def = parse_get_handlers(printfun_def, &pf, spec);
 		if (spec[0] == '%') { /* it's %% specifier really */
 			if (spec.length() > 1) {
 				std::string err("Found `%");
 				err += spec;
 				err += "' specifier for `";
-				err += func;
+				err += pf.spec_to_func[spec];
 				err += "', can handle only `%%'";
 				throw std::logic_error(err);
 			}
 			log::info << "Reserved %% specifier for `"
-				<< func << "'\n";
+				<< pf.spec_to_func[spec] << "'\n";
 		}
+		if (spec == "v")
+			log::info << "Reserved %v specifier for `"
+				<< pf.spec_to_func[spec]
+				<< "', using vectored output\n";
+		if (spec == "{")
+			log::info << "Reserved %{ specifier for `"
+				<< pf.spec_to_func[spec]
+				<< "', using write cursor handlers\n";
+		if (spec == "}")
+			log::info << "Reserved %} specifier for `"
+				<< pf.spec_to_func[spec] << "'\n";
+		if (spec == "^")
+			log::info << "Reserved %^ specifier for `"
+				<< pf.spec_to_func[spec]
+				<< "', reserving output length\n";
+		if (spec == "[")
+			log::info << "Reserved %[ specifier for `"
+				<< pf.spec_to_func[spec]
+				<< "', locking the whole line\n";
+		if (spec == "]")
+			log::info << "Reserved %] specifier for `"
+				<< pf.spec_to_func[spec] << "'\n";
+		if (spec == "b")
+			log::info << "Reserved %b specifier for `"
+				<< pf.spec_to_func[spec]
+				<< "', using binary records\n";
+	}
+
+	if (has_spec(pf, "{") != has_spec(pf, "}")) {
+		std::string err("Cursor handlers of `");
+		err += fun_name;
+		throw std::logic_error(err + "' need both %{ and %} hooks");
+	}
+	if (pf.buffer && (has_spec(pf, "v") || has_spec(pf, "{") ||
+				has_spec(pf, "^"))) {
+		std::string err("Buffer function `");
+		err += fun_name;
+		throw std::logic_error(err +
+			"' can't have %v, %{, %} or %^ hooks");
+	}
+	if (pf.count && has_spec(pf, "{")) {
+		std::string err("Cursor handlers of `");
+		err += fun_name;
+		throw std::logic_error(err + "' can't return bytes count");
+	}
+	if (has_spec(pf, "{") && has_spec(pf, "v")) {
+		std::string err("Function `");
+		err += fun_name;
+		throw std::logic_error(err +
+			"' can't use both cursor and vectored output");
+	}
+
+	if (has_spec(pf, "[") != has_spec(pf, "]")) {
+		std::string err("Lock bracket of `");
+		err += fun_name;
+		throw std::logic_error(err + "' needs both %[ and %] hooks");
+	}
+	if (has_spec(pf, "[") && (pf.buffer || has_spec(pf, "v") ||
+				has_spec(pf, "{") || has_spec(pf, "b"))) {
+		std::string err("Lock bracket of `");
+		err += fun_name;
+		throw std::logic_error(err +
+			"' works only with handler per format part");
+	}
+	if (has_spec(pf, "b") && (pf.buffer || pf.count ||
+				pf.spec_to_func.size() > 1)) {
+		std::string err("Binary records function `");
+		err += fun_name;
+		throw std::logic_error(err +
+			"' can't have other handlers, buffer or count modes");
 	}
 
 	if (i == 0) {
@@ -143,12 +420,338 @@ void add_printfun(const char *printfun_def)
 	printfuns[fun_name] = pf;
 
 	log::info << "Specifier handlers for `"
-		<< fun_name << "(" << pf.fmt_pos << ")':\n";
+		<< fun_name << "(" << pf.fmt_pos << ")"
+		<< (pf.buffer ? ">" : "") << (pf.count ? "+" : "")
+		<< (pf.guard.empty() ? "" : " ?") << pf.guard << "':\n";
 	std::map<std::string, std::string>::const_iterator s;
-	for (s = pf.spec_to_func.cbegin(); s != pf.spec_to_func.cend(); ++s)
-		log::debug << "\t%" << (*s).first
-			<< "\t" << (*s).second << std::endl;
+	for (s = pf.spec_to_func.cbegin(); s != pf.spec_to_func.cend(); ++s) {
+		const std::string &spec = (*s).first;
+
+		log::debug << "\t%" << spec << "\t" << (*s).second;
+		if (pf.spec_to_overloads.find(spec) !=
+				pf.spec_to_overloads.end()) {
+			const std::vector<std::pair<std::string,
+				std::string> > &o = pf.spec_to_overloads.at(spec);
+
+			for (size_t j = 0; j < o.size(); j++)
+				log::debug << " " << o[j].first
+					<< ":" << o[j].second;
+		}
+		if (pf.unlocked.find((*s).second) != pf.unlocked.end())
+			log::debug << "|" << pf.unlocked.at((*s).second);
+		if (pf.spec_to_nargs.at(spec) > 1)
+			log::debug << "/" << pf.spec_to_nargs.at(spec);
+		log::debug << std::endl;
+	}
 }
 
-}; /* namespace printfun */
+static const char *level_filter_ops[] = {
+	">=", "<=", "==", "!=", ">", "<",
+};
+
+/*
+ * Compile-time level floor: `[func:]fmt_argN<op>V' allows calls only if
+ * prefix argument N is constant, that satisfies the condition, or isn't
+ * constant. Other calls are deleted.
+ */
+void add_level_filter(const char *filter_def)
+{
+	level_filter_t f;
+	std::string name;
+	size_t len;
+
+	filter_def = parse_get_function(filter_def, &name);
+	if (*filter_def == ':') {
+		f.func = name;
+		name.clear();
+		filter_def = parse_get_function(filter_def + 1, &name);
+	}
+	if (name.compare(0, 7, "fmt_arg") || name.length() == 7 ||
+			name.find_first_not_of("0123456789", 7) !=
+			std::string::npos) {
+		std::string err("Expected fmt_argN, but got `");
+		throw std::logic_error(err + name + "'");
+	}
+	try {
+		f.arg = std::stoul(name.substr(7));
+	} catch(...) {
+		std::string err("Invalid argument number in `");
+		throw std::logic_error(err + name + "'");
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(level_filter_ops); i++) {
+		if (strncmp(filter_def, level_filter_ops[i],
+					strlen(level_filter_ops[i])))
+			continue;
+		f.op = level_filter_ops[i];
+		filter_def += f.op.length();
+		break;
+	}
+	if (f.op.empty()) {
+		std::string err("Unknown comparison in level filter: `");
+		throw std::logic_error(err + filter_def + "'");
+	}
+
+	try {
+		f.value = std::stoll(filter_def, &len, 0);
+	} catch(...) {
+		std::string err("Invalid level in filter: `");
+		throw std::logic_error(err + filter_def + "'");
+	}
+	if (filter_def[len] != '\0') {
+		std::string err("Unexpected `");
+		throw std::logic_error(err + (filter_def + len) +
+			"' after level filter");
+	}
+
+	level_filters.push_back(f);
+	log::info << "Deleting calls" << (f.func.empty() ? "" : " to `")
+		<< f.func << (f.func.empty() ? "" : "'")
+		<< " unless constant argument " << f.arg << " "
+		<< f.op << " " << f.value << "\n";
+}
+
+bool level_filter_allows(const level_filter_t &f, long long level)
+{
+	if (f.op == ">=")
+		return level >= f.value;
+	if (f.op == "<=")
+		return level <= f.value;
+	if (f.op == "==")
+		return level == f.value;
+	if (f.op == "!=")
+		return level != f.value;
+	if (f.op == ">")
+		return level > f.value;
+	return level < f.value;
+}
+
+static unsigned long parse_ratelimit_number(const char **def)
+{
+	unsigned long ret;
+	size_t len;
+
+	try {
+		ret = std::stoul(*def, &len, 10);
+	} catch(...) {
+		std::string err("Invalid number in rate limit: `");
+		throw std::logic_error(err + *def + "'");
+	}
+	if (ret == 0 || ret > UINT_MAX)
+		throw std::logic_error("Rate limit should be positive 32-bit number");
+	*def += len;
+	return ret;
+}
+
+/*
+ * Per-site rate limit: `[func:]K/N' prints K of every N calls,
+ * `[func:]N/s' prints at most N calls per second.
+ */
+void add_ratelimit(const char *ratelimit_def)
+{
+	ratelimit_t rl;
+
+	if (ISALPHA(*ratelimit_def) || *ratelimit_def == '_') {
+		ratelimit_def = parse_get_function(ratelimit_def, &rl.func);
+		if (*ratelimit_def++ != ':') {
+			std::string err("Expected `:' after `");
+			throw std::logic_error(err + rl.func + "'");
+		}
+	}
+
+	rl.count = parse_ratelimit_number(&ratelimit_def);
+	if (*ratelimit_def++ != '/')
+		throw std::logic_error("Expected `/' in rate limit");
+	rl.per_sec = (*ratelimit_def == 's');
+	if (rl.per_sec) {
+		rl.period = 1;
+		ratelimit_def++;
+	} else {
+		rl.period = parse_ratelimit_number(&ratelimit_def);
+		if (rl.count > rl.period)
+			throw std::logic_error("Rate limit allows more calls than there are");
+	}
+	if (*ratelimit_def != '\0') {
+		std::string err("Unexpected `");
+		throw std::logic_error(err + ratelimit_def +
+			"' after rate limit");
+	}
+
+	if (printfuns.find(rl.func) != printfuns.end() &&
+			printfuns.at(rl.func).buffer) {
+		std::string err("Buffer function `");
+		throw std::logic_error(err + rl.func + "' can't be rate limited");
+	}
+	for (size_t i = 0; i < ratelimits.size(); i++) {
+		if (ratelimits[i].func != rl.func)
+			continue;
+		std::string err("Rate limit for `");
+		throw std::logic_error(err + rl.func + "' defined twice");
+	}
+	ratelimits.push_back(rl);
+	log::info << "Rate limit" << (rl.func.empty() ? "" : " for `")
+		<< rl.func << (rl.func.empty() ? "" : "'") << ": "
+		<< rl.count << "/";
+	if (rl.per_sec)
+		log::info << "s\n";
+	else
+		log::info << rl.period << "\n";
+}
 
+/* Rate limit for function, or the default one */
+const ratelimit_t *find_ratelimit(const std::string &func)
+{
+	const ratelimit_t *ret = NULL;
+
+	/* Buffer functions always write their output */
+	if (printfuns.find(func) != printfuns.end() &&
+			printfuns.at(func).buffer)
+		return NULL;
+	for (size_t i = 0; i < ratelimits.size(); i++) {
+		if (ratelimits[i].func == func)
+			return &ratelimits[i];
+		if (ratelimits[i].func.empty())
+			ret = &ratelimits[i];
+	}
+	return ret;
+}
+
+/* `profile' or `profile=1' turns on per-site profiler */
+void set_profile(const char *arg)
+{
+	std::string val(arg ? arg : "1");
+
+	if (val == "1" || val == "on")
+		profile_sites = true;
+	else if (val == "0" || val == "off")
+		profile_sites = false;
+	else
+		throw std::logic_error("Expected profile=on|off");
+	log::info << "Per-site profiler is "
+		<< (profile_sites ? "on" : "off") << "\n";
+}
+
+/* `outline' moves expansions to shared cold functions */
+void set_outline(const char *arg)
+{
+	std::string val(arg ? arg : "1");
+
+	if (val == "1" || val == "on")
+		outline_calls = true;
+	else if (val == "0" || val == "off")
+		outline_calls = false;
+	else
+		throw std::logic_error("Expected outline=on|off");
+	log::info << "Outlining of expanded calls is "
+		<< (outline_calls ? "on" : "off") << "\n";
+}
+
+/* `batch' merges runs of adjacent calls */
+void set_batch(const char *arg)
+{
+	std::string val(arg ? arg : "1");
+
+	if (val == "1" || val == "on")
+		batch_calls = true;
+	else if (val == "0" || val == "off")
+		batch_calls = false;
+	else
+		throw std::logic_error("Expected batch=on|off");
+	log::info << "Batching of adjacent calls is "
+		<< (batch_calls ? "on" : "off") << "\n";
+}
+
+/*
+ * Cold call sites policy: `cold=expand|outline|keep[/N]', sites with at
+ * most N tokens are expanded in place anyway.
+ */
+void set_cold_policy(const char *arg)
+{
+	std::string val(arg ? arg : "");
+	std::string action = val.substr(0, val.find('/'));
+
+	if (action == "expand")
+		cold_policy.action = cold_policy_t::EXPAND;
+	else if (action == "outline")
+		cold_policy.action = cold_policy_t::OUTLINE;
+	else if (action == "keep")
+		cold_policy.action = cold_policy_t::KEEP;
+	else
+		throw std::logic_error("Expected cold=expand|outline|keep[/N]");
+
+	cold_policy.max_tokens = 0;
+	if (action.length() != val.length()) {
+		const char *num = val.c_str() + action.length() + 1;
+		size_t len;
+
+		try {
+			cold_policy.max_tokens = std::stoul(num, &len, 10);
+		} catch(...) {
+			std::string err("Invalid number of tokens: `");
+			throw std::logic_error(err + num + "'");
+		}
+		if (num[len] != '\0') {
+			std::string err("Unexpected `");
+			throw std::logic_error(err + (num + len) +
+				"' after number of tokens");
+		}
+	}
+	log::info << "Cold call sites: " << action << ", expanding up to "
+		<< cold_policy.max_tokens << " tokens\n";
+}
+
+/*
+ * Cost model: `cost=key=N[,key=N...]' with keys
+ *	char_max	literals up to N chars are printed with %c calls
+ *	sized_min	literals from N chars use %%, shorter ones %s
+ *	store_max	buffer mode stores literals up to N bytes one by one
+ *	max_tokens	calls with more tokens aren't expanded, 0 - any;
+ *			not for %v and %b, which are one call anyway
+ */
+void set_cost_model(const char *arg)
+{
+	std::string def(arg ? arg : "");
+	size_t pos = 0;
+
+	while (pos < def.length()) {
+		size_t end = def.find(',', pos);
+		size_t eq = def.find('=', pos);
+		std::string key, val;
+		unsigned long *field;
+		size_t len;
+
+		if (end == std::string::npos)
+			end = def.length();
+		if (eq == std::string::npos || eq > end)
+			throw std::logic_error("Expected `key=N' in cost model");
+		key = def.substr(pos, eq - pos);
+		val = def.substr(eq + 1, end - eq - 1);
+		pos = end + 1;
+
+		if (key == "char_max")
+			field = &cost_model.char_max;
+		else if (key == "sized_min")
+			field = &cost_model.sized_min;
+		else if (key == "store_max")
+			field = &cost_model.store_max;
+		else if (key == "max_tokens")
+			field = &cost_model.max_tokens;
+		else
+			throw std::logic_error("Unknown cost `" + key + "'");
+
+		try {
+			*field = std::stoul(val, &len, 10);
+		} catch(...) {
+			len = 0;
+		}
+		if (val.empty() || len != val.length())
+			throw std::logic_error("Invalid number for cost `" +
+				key + "': `" + val + "'");
+	}
+	log::info << "Cost model: char_max=" << cost_model.char_max
+		<< ", sized_min=" << cost_model.sized_min
+		<< ", store_max=" << cost_model.store_max
+		<< ", max_tokens=" << cost_model.max_tokens << "\n";
+}
+
+}; /* namespace printfun */
@@ -4,18 +4,75 @@
 #include <string>
 #include <gcc-plugin.h>
 #include <map>
+#include <vector>
 
 namespace printfun {
 
 struct printfun_t {
 	unsigned int				fmt_pos;
+	bool					buffer;	/* sprintf()-like */
+	bool					count;	/* handlers return int */
+	std::string				guard;	/* enables printing */
 	std::map<std::string, std::string>	spec_to_func;
-	std::map<std::string, tree>		spec_to_tree;
+	std::map<std::string, unsigned int>	spec_to_nargs;
+	/* (argument type, handler) overloads */
+	std::map<std::string, std::vector<std::pair<std::string,
+		std::string> > >		spec_to_overloads;
+	/* handler variants to call inside %[ %] lock bracket */
+	std::map<std::string, std::string>	unlocked;
+};
+
+/* Allowed range of constant prefix argument */
+struct level_filter_t {
+	std::string				func;	/* empty for all */
+	unsigned int				arg;
+	std::string				op;
+	long long				value;
+};
+
+/* Per-site rate limit: count calls of every period, or per second */
+struct ratelimit_t {
+	std::string				func;	/* empty for all */
+	unsigned long				count;
+	unsigned long				period;
+	bool					per_sec;
+};
+
+/* What to do with cold call sites, smaller ones are still expanded */
+struct cold_policy_t {
+	enum { EXPAND, OUTLINE, KEEP }		action;
+	unsigned long				max_tokens;
+};
+
+/* Expansion costs, literal lengths are in bytes */
+struct cost_model_t {
+	unsigned long				char_max;	/* %c chain */
+	unsigned long				sized_min;	/* %% over %s */
+	unsigned long				store_max;	/* byte stores */
+	unsigned long				max_tokens;	/* 0: any */
 };
 
 extern std::map<std::string, printfun_t> printfuns;
+extern std::vector<level_filter_t> level_filters;
+extern std::vector<ratelimit_t> ratelimits;
+extern bool profile_sites;
+extern bool outline_calls;
+extern bool batch_calls;
+extern cold_policy_t cold_policy;
+extern cost_model_t cost_model;
 
 void add_printfun(const char *printfun_def);
+void add_level_filter(const char *filter_def);
+bool level_filter_allows(const level_filter_t &f, long long level);
+void add_ratelimit(const char *ratelimit_def);
+const ratelimit_t *find_ratelimit(const std::string &func);
+void set_profile(const char *arg);
+void set_outline(const char *arg);
+void set_batch(const char *arg);
+void set_cold_policy(const char *arg);
+void set_cost_model(const char *arg);
+bool is_overload_type(const std::string &type);
+bool is_reserved(const std::string &spec);
 
 }; /* namespace printfun */
 
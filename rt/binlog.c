@@ -0,0 +1,22 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cprintf-rt.h"
+#include "record.h"
+
+/* Record ID is it's offset in the section */
+extern const char __start_cprintf_fmt[] __attribute__((weak));
+
+void cprintf_bin_write(int fd, const char *rec,
+		const unsigned long long *slots)
+{
+	char buf[sizeof(struct record_header) + RECORD_PAYLOAD_MAX];
+	struct record_header hdr;
+
+	hdr.id = rec - __start_cprintf_fmt;
+	hdr.len = record_encode(buf + sizeof(hdr), RECORD_PAYLOAD_MAX,
+			rec, slots);
+	memcpy(buf, &hdr, sizeof(hdr));
+	write(fd, buf, sizeof(hdr) + hdr.len);
+}
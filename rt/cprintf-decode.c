@@ -0,0 +1,144 @@
+/*
+ * Decoder for binary records, written by cprintf_bin_write():
+ *	cprintf-decode <program> [<log>]
+ * Format strings are read from `cprintf_fmt' section of the program,
+ * which wrote the log, records are read from <log> or stdin.
+ */
+#include <elf.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "record.h"
+
+static const char *prog;
+
+static void die(const char *msg, const char *arg)
+{
+	fprintf(stderr, "%s: %s%s%s\n", prog, msg, arg ? ": " : "",
+			arg ? arg : "");
+	exit(1);
+}
+
+static char *read_file(const char *path, size_t *size)
+{
+	FILE *f = fopen(path, "rb");
+	char *buf = NULL;
+	size_t len = 0, n;
+
+	if (f == NULL)
+		die(strerror(errno), path);
+	do {
+		buf = realloc(buf, len + 65536);
+		if (buf == NULL)
+			die("out of memory", NULL);
+		n = fread(buf + len, 1, 65536, f);
+		len += n;
+	} while (n != 0);
+	if (ferror(f))
+		die("read failed", path);
+	fclose(f);
+	*size = len;
+	return buf;
+}
+
+/* Finds the section of 64-bit ELF file in the host byte order */
+static const char *find_fmt_section(const char *elf, size_t size,
+		size_t *sec_size)
+{
+	const Elf64_Ehdr *eh = (const Elf64_Ehdr *)elf;
+	const Elf64_Shdr *sh, *strtab;
+	unsigned int i;
+
+	if (size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG))
+		die("not an ELF file", NULL);
+	if (eh->e_ident[EI_CLASS] != ELFCLASS64)
+		die("only 64-bit ELF files are supported", NULL);
+	if (eh->e_shoff + (size_t)eh->e_shnum * sizeof(*sh) > size ||
+			eh->e_shstrndx >= eh->e_shnum)
+		die("broken section headers", NULL);
+
+	sh = (const Elf64_Shdr *)(elf + eh->e_shoff);
+	strtab = &sh[eh->e_shstrndx];
+	for (i = 0; i < eh->e_shnum; i++) {
+		if (sh[i].sh_name >= strtab->sh_size ||
+				strcmp(elf + strtab->sh_offset + sh[i].sh_name,
+					"cprintf_fmt"))
+			continue;
+		if (sh[i].sh_offset + sh[i].sh_size > size)
+			die("broken cprintf_fmt section", NULL);
+		*sec_size = sh[i].sh_size;
+		return elf + sh[i].sh_offset;
+	}
+	die("no cprintf_fmt section, was it built with %b hook?", NULL);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	const char *sec;
+	size_t elf_size, sec_size;
+	char *elf, *buf = NULL, *text = NULL;
+	size_t buf_size = 0, text_size = 0;
+	FILE *log = stdin;
+
+	prog = argv[0];
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s <program> [<log>]\n", prog);
+		return 1;
+	}
+	elf = read_file(argv[1], &elf_size);
+	sec = find_fmt_section(elf, elf_size, &sec_size);
+	if (argc == 3 && (log = fopen(argv[2], "rb")) == NULL)
+		die(strerror(errno), argv[2]);
+
+	for (;;) {
+		struct record_header hdr;
+		const char *kinds, *fmt;
+		int len;
+
+		if (fread(&hdr, sizeof(hdr), 1, log) != 1)
+			break;
+		if (hdr.len > buf_size) {
+			buf = realloc(buf, hdr.len);
+			if (buf == NULL)
+				die("out of memory", NULL);
+			buf_size = hdr.len;
+		}
+		if (fread(buf, 1, hdr.len, log) != hdr.len)
+			die("truncated record", NULL);
+		if (hdr.id >= sec_size)
+			die("unknown record ID, is it the right program?",
+					NULL);
+
+		kinds = sec + hdr.id;
+		fmt = kinds + strnlen(kinds, sec_size - hdr.id) + 1;
+		if (fmt >= sec + sec_size ||
+				strnlen(fmt, sec + sec_size - fmt) ==
+				(size_t)(sec + sec_size - fmt))
+			die("broken cprintf_fmt section", NULL);
+
+		len = record_format(text, text_size, kinds, buf, hdr.len);
+		if (len >= 0 && (size_t)len >= text_size) {
+			text_size = len + 1;
+			text = realloc(text, text_size);
+			if (text == NULL)
+				die("out of memory", NULL);
+			len = record_format(text, text_size, kinds,
+					buf, hdr.len);
+		}
+		if (len < 0) {
+			fprintf(stderr, "%s: record doesn't match its format, skipped\n",
+					prog);
+			continue;
+		}
+		fwrite(text, 1, len, stdout);
+	}
+
+	free(text);
+	free(buf);
+	free(elf);
+	return 0;
+}
@@ -0,0 +1,65 @@
+#ifndef CPRINTF_RT_H
+#define CPRINTF_RT_H
+
+#include <stddef.h>
+
+/*
+ * Runtime for code, compiled with cprintf plugin.
+ * Link with -lcprintf-rt.
+ */
+
+/*
+ * Per-site profiler (plugin argument `profile'): writes `top' call
+ * sites with the most hits to fd. Called at exit and on SIGUSR2.
+ */
+void cprintf_profile_dump(int fd, unsigned int top);
+
+/*
+ * Binary records (%b hook): writes record ID and argument slots to fd
+ * with one write(), strings are copied. Use rt/cprintf-decode to get
+ * the text back: `dprintf(1): %b cprintf_bin_write'.
+ */
+void cprintf_bin_write(int fd, const char *rec,
+		const unsigned long long *slots);
+
+/*
+ * The same records, formatted to text by background thread: the call
+ * only copies slots to per-thread ring buffer without locks, the text
+ * is written in batches. Records of one thread keep their order.
+ */
+void cprintf_ring_write(int fd, const char *rec,
+		const unsigned long long *slots);
+
+/*
+ * Integer kernels for %d, %u, %ld, %lu, %lld and %llu handlers: write
+ * digits (with `-' for negative values) to buf without terminating NUL
+ * and return their count. buf should fit 20 characters.
+ */
+size_t cprintf_fmt_int(char *buf, int v);
+size_t cprintf_fmt_uint(char *buf, unsigned int v);
+size_t cprintf_fmt_long(char *buf, long v);
+size_t cprintf_fmt_ulong(char *buf, unsigned long v);
+size_t cprintf_fmt_llong(char *buf, long long v);
+size_t cprintf_fmt_ullong(char *buf, unsigned long long v);
+
+/*
+ * Hex kernels for %x, %X and %p in the same manner, 64-bit values are
+ * expanded with SSSE3 if CPU supports it. Fixed width ones are for
+ * `%08x' and `%016lx' handlers: zero-padded, without digit counting.
+ */
+size_t cprintf_fmt_hex(char *buf, unsigned long long v);
+size_t cprintf_fmt_hex_upper(char *buf, unsigned long long v);
+size_t cprintf_fmt_hex8(char *buf, unsigned int v);
+size_t cprintf_fmt_hex16(char *buf, unsigned long long v);
+size_t cprintf_fmt_ptr(char *buf, const void *p);
+
+/*
+ * Float kernels for %f, %e and %g with precision prec (-1 for default
+ * one, as `%~'-handlers get it): exactly printf() output without flags
+ * and width, written to buf like snprintf() does.
+ */
+size_t cprintf_fmt_f(char *buf, size_t size, double v, int prec);
+size_t cprintf_fmt_e(char *buf, size_t size, double v, int prec);
+size_t cprintf_fmt_g(char *buf, size_t size, double v, int prec);
+
+#endif /* CPRINTF_RT_H */
@@ -0,0 +1,293 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cprintf-rt.h"
+
+/*
+ * Float kernels for %f, %e and %g with given precision. printf()
+ * rounds the exact binary value, so do they: the value m * 2^e is
+ * scaled by power of 10 in 128-bit integers and rounded half to even.
+ * Values, that don't fit (huge, tiny or too precise), as well as
+ * infinities and NaNs go to snprintf().
+ */
+typedef unsigned __int128 u128;
+
+#define DEFAULT_PREC	6
+#define MAX_PREC	17
+#define POW10_MAX	38
+
+static u128 pow10_128[POW10_MAX + 1];
+
+static void __attribute__((constructor)) pow10_init(void)
+{
+	int i;
+
+	pow10_128[0] = 1;
+	for (i = 1; i <= POW10_MAX; i++)
+		pow10_128[i] = pow10_128[i - 1] * 10;
+}
+
+static inline unsigned int bit_len(u128 v)
+{
+	uint64_t hi = v >> 64;
+
+	if (hi)
+		return 128 - __builtin_clzll(hi);
+	return 64 - __builtin_clzll((uint64_t)v | 1);
+}
+
+/* Splits finite double into m * 2^e, returns sign */
+static inline int decompose(double v, uint64_t *m, int *e)
+{
+	uint64_t bits;
+	int exp;
+
+	memcpy(&bits, &v, sizeof(bits));
+	exp = (bits >> 52) & 0x7ff;
+	*m = bits & ((1ULL << 52) - 1);
+	if (exp) {
+		*m |= 1ULL << 52;
+		*e = exp - 1075;
+	} else {
+		*e = -1074;
+	}
+	return bits >> 63;
+}
+
+/*
+ * Rounds m * 2^e * 10^n to integer, half to even.
+ * Returns -1 if it doesn't fit into 64 bits or 128-bit arithmetic.
+ */
+static int scale_round(uint64_t m, int e, int n, uint64_t *out)
+{
+	u128 num = m, den = 1, q, rem;
+
+	if (n > POW10_MAX || -n > POW10_MAX)
+		return -1;
+	if (n >= 0) {
+		if (bit_len(num) + bit_len(pow10_128[n]) > 127)
+			return -1;
+		num *= pow10_128[n];
+	} else {
+		den = pow10_128[-n];
+	}
+
+	if (e >= 0) {
+		if (bit_len(num) + e > 127)
+			return -1;
+		num <<= e;
+	} else if (den == 1) {
+		/* the most common case: shift instead of division */
+		unsigned int shift = -e;
+		u128 half;
+
+		/* less than a half */
+		if (shift > bit_len(num)) {
+			q = 0;
+			goto done;
+		}
+		q = num >> shift;
+		rem = num - (q << shift);
+		half = (u128)1 << (shift - 1);
+		if (rem > half || (rem == half && (q & 1)))
+			q++;
+		goto done;
+	} else {
+		if (bit_len(den) - e > 127)
+			return -1;
+		den <<= -e;
+	}
+
+	q = num / den;
+	rem = num - q * den;
+	/* rem vs den / 2 without overflow */
+	if (rem > den - rem || (rem == den - rem && (q & 1)))
+		q++;
+done:
+	if (q >> 64)
+		return -1;
+	*out = q;
+	return 0;
+}
+
+/* Copies formatted number out the way snprintf() does */
+static size_t copy_out(char *buf, size_t size, const char *s, size_t len)
+{
+	if (size) {
+		size_t n = len < size ? len : size - 1;
+
+		memcpy(buf, s, n);
+		buf[n] = '\0';
+	}
+	return len;
+}
+
+/* Exactly `width' digits, zero-padded */
+static char *put_padded(char *p, uint64_t v, int width)
+{
+	char tmp[20];
+	size_t len = cprintf_fmt_ullong(tmp, v);
+
+	memset(p, '0', width - len);
+	memcpy(p + width - len, tmp, len);
+	return p + width;
+}
+
+static inline int is_finite(double v)
+{
+	return v - v == 0;
+}
+
+size_t cprintf_fmt_f(char *buf, size_t size, double v, int prec)
+{
+	char tmp[64], *p = tmp;
+	uint64_t m, q, div;
+	int e, sign;
+
+	if (prec < 0)
+		prec = DEFAULT_PREC;
+	if (!is_finite(v) || prec > MAX_PREC)
+		goto fallback;
+	sign = decompose(v, &m, &e);
+	if (scale_round(m, e, prec, &q))
+		goto fallback;
+
+	div = (uint64_t)pow10_128[prec];
+	if (sign)
+		*p++ = '-';
+	p += cprintf_fmt_ullong(p, q / div);
+	if (prec) {
+		*p++ = '.';
+		p = put_padded(p, q % div, prec);
+	}
+	return copy_out(buf, size, tmp, p - tmp);
+
+fallback:
+	return snprintf(buf, size, "%.*f", prec, v);
+}
+
+/*
+ * Rounds to prec + 1 significant digits: *digits * 10^(*exp - prec).
+ * Decimal exponent is estimated from the binary one and corrected.
+ */
+static int round_sig(double v, int prec, uint64_t *digits, int *exp)
+{
+	uint64_t m, d;
+	int e, k;
+
+	decompose(v, &m, &e);
+	if (m == 0) {
+		*digits = 0;
+		*exp = 0;
+		return 0;
+	}
+	/* floor(log2(v) * log10(2)), off by one at most */
+	k = ((e + (int)bit_len(m) - 1) * 78913) >> 18;
+	for (;;) {
+		if (scale_round(m, e, prec - k, &d))
+			return -1;
+		if (d >= (uint64_t)pow10_128[prec + 1])
+			k++;
+		else if (d < (uint64_t)pow10_128[prec])
+			k--;
+		else
+			break;
+	}
+	*digits = d;
+	*exp = k;
+	return 0;
+}
+
+static char *put_exp(char *p, int exp)
+{
+	*p++ = 'e';
+	*p++ = exp < 0 ? '-' : '+';
+	if (exp < 0)
+		exp = -exp;
+	if (exp < 10)
+		*p++ = '0';
+	return p + cprintf_fmt_uint(p, exp);
+}
+
+size_t cprintf_fmt_e(char *buf, size_t size, double v, int prec)
+{
+	char tmp[64], *p = tmp;
+	uint64_t d, div;
+	int exp;
+
+	if (prec < 0)
+		prec = DEFAULT_PREC;
+	if (!is_finite(v) || prec > MAX_PREC ||
+			round_sig(v, prec, &d, &exp))
+		goto fallback;
+
+	div = (uint64_t)pow10_128[prec];
+	if (signbit(v))
+		*p++ = '-';
+	*p++ = '0' + d / div;
+	if (prec) {
+		*p++ = '.';
+		p = put_padded(p, d % div, prec);
+	}
+	p = put_exp(p, exp);
+	return copy_out(buf, size, tmp, p - tmp);
+
+fallback:
+	return snprintf(buf, size, "%.*e", prec, v);
+}
+
+/* %g drops trailing zeros of fraction and the point */
+static char *strip_zeros(char *start, char *end)
+{
+	char *point = memchr(start, '.', end - start);
+
+	if (point == NULL)
+		return end;
+	while (end[-1] == '0')
+		end--;
+	if (end[-1] == '.')
+		end--;
+	return end;
+}
+
+size_t cprintf_fmt_g(char *buf, size_t size, double v, int prec)
+{
+	char tmp[64], *p = tmp;
+	uint64_t d, div;
+	int exp;
+
+	if (prec < 0)
+		prec = DEFAULT_PREC;
+	else if (prec == 0)
+		prec = 1;
+	if (!is_finite(v) || prec - 1 > MAX_PREC ||
+			round_sig(v, prec - 1, &d, &exp))
+		goto fallback;
+
+	if (exp < prec && exp >= -4) {
+		size_t len = cprintf_fmt_f(tmp, sizeof(tmp), v,
+				prec - 1 - exp);
+
+		if (len >= sizeof(tmp))
+			goto fallback;
+		p = strip_zeros(tmp, tmp + len);
+		return copy_out(buf, size, tmp, p - tmp);
+	}
+
+	div = (uint64_t)pow10_128[prec - 1];
+	if (signbit(v))
+		*p++ = '-';
+	*p++ = '0' + d / div;
+	if (prec > 1) {
+		*p++ = '.';
+		p = put_padded(p, d % div, prec - 1);
+		p = strip_zeros(tmp, p);
+	}
+	p = put_exp(p, exp);
+	return copy_out(buf, size, tmp, p - tmp);
+
+fallback:
+	return snprintf(buf, size, "%.*g", prec, v);
+}
@@ -0,0 +1,103 @@
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#define HAVE_SSSE3_HEX
+#endif
+
+#include "cprintf-rt.h"
+
+/*
+ * Hex kernels: all 16 nibbles of 64-bit value are expanded to ASCII at
+ * once (with SSSE3 pshufb where CPU has it) and the wanted tail is
+ * copied out; the length comes from the bit length.
+ */
+static const char hex_lower[16] = "0123456789abcdef";
+static const char hex_upper[16] = "0123456789ABCDEF";
+
+static inline void hex16_scalar(char out[16], uint64_t v, const char *digits)
+{
+	int i;
+
+	for (i = 15; i >= 0; i--) {
+		out[i] = digits[v & 0xf];
+		v >>= 4;
+	}
+}
+
+#ifdef HAVE_SSSE3_HEX
+__attribute__((target("ssse3")))
+static void hex16_ssse3(char out[16], uint64_t v, const char *digits)
+{
+	__m128i table = _mm_loadu_si128((const __m128i *)digits);
+	__m128i mask = _mm_set1_epi8(0xf);
+	/* the most significant byte goes first */
+	__m128i x = _mm_cvtsi64_si128(__builtin_bswap64(v));
+	__m128i lo = _mm_and_si128(x, mask);
+	__m128i hi = _mm_and_si128(_mm_srli_epi64(x, 4), mask);
+	/* high nibble of every byte before the low one */
+	__m128i nibbles = _mm_unpacklo_epi8(hi, lo);
+
+	_mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(table, nibbles));
+}
+#endif
+
+static inline void hex16(char out[16], uint64_t v, const char *digits)
+{
+#ifdef HAVE_SSSE3_HEX
+	if (__builtin_cpu_supports("ssse3")) {
+		hex16_ssse3(out, v, digits);
+		return;
+	}
+#endif
+	hex16_scalar(out, v, digits);
+}
+
+static inline size_t fmt_hex(char *buf, uint64_t v, const char *digits)
+{
+	size_t len = (64 - __builtin_clzll(v | 1) + 3) / 4;
+	char tmp[16];
+
+	hex16(tmp, v, digits);
+	memcpy(buf, tmp + 16 - len, len);
+	return len;
+}
+
+size_t cprintf_fmt_hex(char *buf, unsigned long long v)
+{
+	return fmt_hex(buf, v, hex_lower);
+}
+
+size_t cprintf_fmt_hex_upper(char *buf, unsigned long long v)
+{
+	return fmt_hex(buf, v, hex_upper);
+}
+
+/* Fixed width variants for `%08x' and `%016lx' handlers */
+size_t cprintf_fmt_hex8(char *buf, unsigned int v)
+{
+	char tmp[16];
+
+	hex16(tmp, v, hex_lower);
+	memcpy(buf, tmp + 8, 8);
+	return 8;
+}
+
+size_t cprintf_fmt_hex16(char *buf, unsigned long long v)
+{
+	hex16(buf, v, hex_lower);
+	return 16;
+}
+
+/* `%p' the way glibc prints it */
+size_t cprintf_fmt_ptr(char *buf, const void *p)
+{
+	if (p == NULL) {
+		memcpy(buf, "(nil)", 5);
+		return 5;
+	}
+	buf[0] = '0';
+	buf[1] = 'x';
+	return 2 + fmt_hex(buf + 2, (uintptr_t)p, hex_lower);
+}
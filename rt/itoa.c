@@ -0,0 +1,121 @@
+#include <string.h>
+
+#include "cprintf-rt.h"
+
+/*
+ * Integer kernels: two digits per step from the table, length is known
+ * before writing from the bit length, so digits go to their place
+ * right away. 64-bit values are split into 8-digit chunks, which are
+ * formatted with 32-bit arithmetic.
+ */
+static const char digits2[200] =
+	"00010203040506070809" "10111213141516171819"
+	"20212223242526272829" "30313233343536373839"
+	"40414243444546474849" "50515253545556575859"
+	"60616263646566676869" "70717273747576777879"
+	"80818283848586878889" "90919293949596979899";
+
+static const unsigned long long pow10_table[20] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+	10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+	100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+	100000000000000000ULL, 1000000000000000000ULL,
+	10000000000000000000ULL,
+};
+
+/* Number of decimal digits: log10 from bit length, corrected by table */
+static inline unsigned int dec_len(unsigned long long v)
+{
+	unsigned int bits, t;
+
+	v |= 1;		/* 0 has one digit, the others keep their length */
+	bits = 64 - __builtin_clzll(v);
+	t = (bits * 1233) >> 12;	/* bits * log10(2) */
+	return t + (v >= pow10_table[t]);
+}
+
+/* Writes exactly len digits of v, backwards from end */
+static inline void put_digits(char *end, unsigned int v, unsigned int len)
+{
+	while (len >= 2) {
+		unsigned int r = v % 100;
+
+		v /= 100;
+		end -= 2;
+		memcpy(end, &digits2[r * 2], 2);
+		len -= 2;
+	}
+	if (len)
+		*--end = '0' + v;
+}
+
+static inline size_t fmt_u32(char *buf, unsigned int v)
+{
+	unsigned int len = dec_len(v);
+
+	put_digits(buf + len, v, len);
+	return len;
+}
+
+static inline size_t fmt_u64(char *buf, unsigned long long v)
+{
+	unsigned int len;
+	char *end;
+
+	if (v <= 0xffffffffULL)
+		return fmt_u32(buf, v);
+
+	len = dec_len(v);
+	end = buf + len;
+	/* at most 20 digits: up to two 8-digit chunks and the head */
+	while (v >= 100000000ULL) {
+		put_digits(end, v % 100000000ULL, 8);
+		v /= 100000000ULL;
+		end -= 8;
+	}
+	put_digits(end, v, end - buf);
+	return len;
+}
+
+size_t cprintf_fmt_uint(char *buf, unsigned int v)
+{
+	return fmt_u32(buf, v);
+}
+
+size_t cprintf_fmt_int(char *buf, int v)
+{
+	if (v < 0) {
+		*buf = '-';
+		return 1 + fmt_u32(buf + 1, -(unsigned int)v);
+	}
+	return fmt_u32(buf, v);
+}
+
+size_t cprintf_fmt_ulong(char *buf, unsigned long v)
+{
+	return fmt_u64(buf, v);
+}
+
+size_t cprintf_fmt_long(char *buf, long v)
+{
+	if (v < 0) {
+		*buf = '-';
+		return 1 + fmt_u64(buf + 1, -(unsigned long)v);
+	}
+	return fmt_u64(buf, v);
+}
+
+size_t cprintf_fmt_ullong(char *buf, unsigned long long v)
+{
+	return fmt_u64(buf, v);
+}
+
+size_t cprintf_fmt_llong(char *buf, long long v)
+{
+	if (v < 0) {
+		*buf = '-';
+		return 1 + fmt_u64(buf + 1, -(unsigned long long)v);
+	}
+	return fmt_u64(buf, v);
+}
@@ -0,0 +1,161 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cprintf-rt.h"
+
+/* Record, emitted by cprintf plugin for every call site */
+struct cprintf_site {
+	const char	*file;
+	const char	*fmt;
+	unsigned int	line;
+	unsigned long	bound;	/* max bytes per call, 0 if unknown */
+	unsigned long	hits;
+};
+
+extern struct cprintf_site __start_cprintf_sites[] __attribute__((weak));
+extern struct cprintf_site __stop_cprintf_sites[] __attribute__((weak));
+
+#define PROFILE_TOP	20
+
+/* Escapes format string into buf, so that it's one line */
+static void escape_fmt(char *buf, size_t size, const char *fmt)
+{
+	size_t i = 0;
+
+	for (; *fmt != '\0' && i + 3 < size; fmt++) {
+		switch (*fmt) {
+		case '\n':
+			buf[i++] = '\\';
+			buf[i++] = 'n';
+			break;
+		case '\t':
+			buf[i++] = '\\';
+			buf[i++] = 't';
+			break;
+		default:
+			buf[i++] = *fmt;
+		}
+	}
+	buf[i] = '\0';
+}
+
+/*
+ * Line output without stdio: the dump runs in signal handler, so only
+ * async-signal-safe calls (write()) and the integer kernels are used.
+ */
+static char *put_str(char *p, char *end, const char *s, size_t len)
+{
+	if (len > (size_t)(end - p))
+		len = end - p;
+	memcpy(p, s, len);
+	return p + len;
+}
+
+/* Right-aligned in width columns, like `%*s' */
+static char *put_field(char *p, char *end, const char *s, size_t len,
+		size_t width)
+{
+	for (; width > len && p < end; width--)
+		*p++ = ' ';
+	return put_str(p, end, s, len);
+}
+
+static char *put_num(char *p, char *end, unsigned long v, size_t width)
+{
+	char tmp[20];
+
+	return put_field(p, end, tmp, cprintf_fmt_ulong(tmp, v), width);
+}
+
+/*
+ * Selects sites by hits without allocations or sorting of the section,
+ * so it can be called from signal handler: top * sites comparisons.
+ */
+void cprintf_profile_dump(int fd, unsigned int top)
+{
+	struct cprintf_site *s, *prev = NULL;
+	char line[512], fmt[256];
+	/* The newline always fits */
+	char *p, *end = line + sizeof(line) - 1;
+	unsigned int n;
+
+	p = put_field(line, end, "hits", 4, 12);
+	p = put_str(p, end, " ", 1);
+	p = put_field(p, end, "bytes (max)", 11, 14);
+	p = put_str(p, end, "  site", 6);
+	*p++ = '\n';
+	write(fd, line, p - line);
+
+	for (n = 0; n < top; n++) {
+		struct cprintf_site *best = NULL;
+
+		for (s = __start_cprintf_sites; s < __stop_cprintf_sites; s++) {
+			if (s->hits == 0)
+				continue;
+			/* Order by hits, then by address for equal ones */
+			if (prev && (s->hits > prev->hits ||
+					(s->hits == prev->hits && s <= prev)))
+				continue;
+			if (!best || s->hits > best->hits)
+				best = s;
+		}
+		if (!best)
+			break;
+
+		escape_fmt(fmt, sizeof(fmt), best->fmt);
+		p = put_num(line, end, best->hits, 12);
+		p = put_str(p, end, " ", 1);
+		if (best->bound)
+			p = put_num(p, end, best->hits * best->bound, 14);
+		else
+			p = put_field(p, end, "-", 1, 14);
+		p = put_str(p, end, "  ", 2);
+		p = put_str(p, end, best->file, strlen(best->file));
+		p = put_str(p, end, ":", 1);
+		p = put_num(p, end, best->line, 0);
+		p = put_str(p, end, " \"", 2);
+		p = put_str(p, end, fmt, strlen(fmt));
+		p = put_str(p, end, "\"", 1);
+		*p++ = '\n';
+		write(fd, line, p - line);
+		prev = best;
+	}
+}
+
+/* Read once at startup: getenv() isn't async-signal-safe */
+static unsigned int profile_top = PROFILE_TOP;
+
+static void profile_at_exit(void)
+{
+	cprintf_profile_dump(STDERR_FILENO, profile_top);
+}
+
+static void profile_on_signal(int sig __attribute__((unused)))
+{
+	cprintf_profile_dump(STDERR_FILENO, profile_top);
+}
+
+static void __attribute__((constructor)) profile_init(void)
+{
+	const char *env = getenv("CPRINTF_PROFILE_TOP");
+	struct sigaction sa;
+
+	/* No profiled sites linked in */
+	if (&__start_cprintf_sites[0] == &__stop_cprintf_sites[0])
+		return;
+
+	if (env != NULL)
+		profile_top = strtoul(env, NULL, 10);
+
+	atexit(profile_at_exit);
+
+	/* Don't override application's handler */
+	if (sigaction(SIGUSR2, NULL, &sa) || sa.sa_handler != SIG_DFL)
+		return;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = profile_on_signal;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &sa, NULL);
+}
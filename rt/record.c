@@ -0,0 +1,239 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "record.h"
+
+/* Bytes, that slots of kinds need at least: strings may be empty */
+static size_t record_min_len(const char *kind)
+{
+	size_t len = 0;
+
+	for (; *kind != '\0'; kind++)
+		len += *kind == 's' ? 1 : sizeof(unsigned long long);
+	return len;
+}
+
+/*
+ * Strings are truncated so that all the slots after them fit, the
+ * payload always matches the record, unless it has too many slots.
+ */
+size_t record_encode(char *buf, size_t size, const char *rec,
+		const unsigned long long *slots)
+{
+	size_t rest = record_min_len(rec);
+	const char *kind;
+	size_t off = 0;
+
+	for (kind = rec; *kind != '\0'; kind++, slots++) {
+		const char *str;
+		size_t len;
+
+		/* What the next slots need */
+		rest -= *kind == 's' ? 1 : sizeof(*slots);
+		if (*kind != 's') {
+			if (off + sizeof(*slots) + rest > size)
+				break;
+			memcpy(buf + off, slots, sizeof(*slots));
+			off += sizeof(*slots);
+			continue;
+		}
+
+		str = (const char *)(uintptr_t)*slots;
+		if (str == NULL)
+			str = "(null)";
+		if (off + 1 + rest > size)
+			break;
+		len = strnlen(str, size - off - 1 - rest);
+		memcpy(buf + off, str, len);
+		buf[off + len] = '\0';
+		off += len + 1;
+	}
+	return off;
+}
+
+/* Output buffer, which counts the length past it's size */
+struct out {
+	char	*buf;
+	size_t	size;
+	size_t	len;
+};
+
+static void out_fmt(struct out *o, const char *spec, ...)
+{
+	size_t left = o->len < o->size ? o->size - o->len : 0;
+	va_list args;
+	int n;
+
+	va_start(args, spec);
+	n = vsnprintf(left ? o->buf + o->len : NULL, left, spec, args);
+	va_end(args);
+	if (n > 0)
+		o->len += n;
+}
+
+static void out_char(struct out *o, char c)
+{
+	if (o->len + 1 < o->size)
+		o->buf[o->len] = c;
+	o->len++;
+}
+
+/* Payload reader: slots and copied strings */
+struct payload {
+	const char	*buf;
+	size_t		len;
+	size_t		off;
+};
+
+static int get_slot(struct payload *p, unsigned long long *out)
+{
+	if (p->off + sizeof(*out) > p->len)
+		return -1;
+	memcpy(out, p->buf + p->off, sizeof(*out));
+	p->off += sizeof(*out);
+	return 0;
+}
+
+static const char *get_str(struct payload *p)
+{
+	const char *ret = p->buf + p->off;
+	size_t len;
+
+	if (p->off >= p->len)
+		return NULL;
+	len = strnlen(ret, p->len - p->off);
+	if (p->off + len >= p->len)
+		return NULL;
+	p->off += len + 1;
+	return ret;
+}
+
+/* Formats integer with printf length modifier from conversion */
+static void out_int(struct out *o, const char *spec, const char *len,
+		char conv, unsigned long long v)
+{
+	int is_signed = (conv == 'd' || conv == 'i');
+
+	if (conv == 'c')
+		out_fmt(o, spec, (int)v);
+	else if (!strcmp(len, "hh"))
+		is_signed ? out_fmt(o, spec, (int)(signed char)v) :
+			out_fmt(o, spec, (unsigned int)(unsigned char)v);
+	else if (!strcmp(len, "h"))
+		is_signed ? out_fmt(o, spec, (int)(short)v) :
+			out_fmt(o, spec, (unsigned int)(unsigned short)v);
+	else if (!strcmp(len, "l"))
+		is_signed ? out_fmt(o, spec, (long)v) :
+			out_fmt(o, spec, (unsigned long)v);
+	else if (!strcmp(len, "ll") || !strcmp(len, "q"))
+		is_signed ? out_fmt(o, spec, (long long)v) :
+			out_fmt(o, spec, v);
+	else if (!strcmp(len, "j"))
+		is_signed ? out_fmt(o, spec, (intmax_t)v) :
+			out_fmt(o, spec, (uintmax_t)v);
+	else if (!strcmp(len, "z"))
+		is_signed ? out_fmt(o, spec, (ssize_t)v) :
+			out_fmt(o, spec, (size_t)v);
+	else if (!strcmp(len, "t"))
+		out_fmt(o, spec, (ptrdiff_t)v);
+	else
+		is_signed ? out_fmt(o, spec, (int)v) :
+			out_fmt(o, spec, (unsigned int)v);
+}
+
+/*
+ * Format string from the plugin has only sequential conversions,
+ * `*' width and precision are substituted from slots.
+ */
+int record_format(char *out, size_t size, const char *rec,
+		const char *payload, size_t len)
+{
+	const char *kinds = rec;
+	const char *fmt = rec + strlen(rec) + 1;
+	struct payload p = { payload, len, 0 };
+	struct out o = { out, size, 0 };
+	unsigned long long v;
+
+	while (*fmt != '\0') {
+		char spec[128], lenmod[3] = "";
+		size_t n = 0;
+
+		if (*fmt != '%') {
+			out_char(&o, *fmt++);
+			continue;
+		}
+		if (fmt[1] == '%') {
+			out_char(&o, '%');
+			fmt += 2;
+			continue;
+		}
+
+		spec[n++] = *fmt++;
+		while (*fmt != '\0' && strchr("-+ #0123456789.*", *fmt)) {
+			if (*fmt == '*') {
+				if (*kinds++ != 'i' || get_slot(&p, &v))
+					return -1;
+				/* negative precision is omitted one */
+				if (spec[n - 1] == '.' && (int)v < 0)
+					n--;
+				else
+					n += snprintf(spec + n,
+						sizeof(spec) - n - 8,
+						"%d", (int)v);
+				fmt++;
+				continue;
+			}
+			if (n < sizeof(spec) - 8)
+				spec[n++] = *fmt;
+			fmt++;
+		}
+		while (*fmt != '\0' && strchr("hlLqjzt", *fmt)) {
+			if (strlen(lenmod) < 2)
+				lenmod[strlen(lenmod)] = *fmt;
+			spec[n++] = *fmt++;
+		}
+		if (*fmt == '\0')
+			return -1;
+		spec[n++] = *fmt;
+		spec[n] = '\0';
+
+		switch (*kinds++) {
+		case 'i': case 'u':
+			if (get_slot(&p, &v))
+				return -1;
+			out_int(&o, spec, lenmod, *fmt, v);
+			break;
+		case 'f': {
+			double d;
+
+			if (get_slot(&p, &v))
+				return -1;
+			memcpy(&d, &v, sizeof(d));
+			out_fmt(&o, spec, d);
+			break;
+		}
+		case 's': {
+			const char *str = get_str(&p);
+
+			if (str == NULL)
+				return -1;
+			out_fmt(&o, spec, str);
+			break;
+		}
+		case 'p':
+			if (get_slot(&p, &v))
+				return -1;
+			out_fmt(&o, spec, (void *)(uintptr_t)v);
+			break;
+		default:
+			return -1;
+		}
+		fmt++;
+	}
+
+	if (size)
+		out[o.len < size ? o.len : size - 1] = '\0';
+	return o.len;
+}
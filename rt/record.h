@@ -0,0 +1,39 @@
+#ifndef CPRINTF_RECORD_H
+#define CPRINTF_RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary records from cprintf plugin (%b hook): record in cprintf_fmt
+ * section has kind of every argument slot, NUL, format string, NUL.
+ * Payload has 8-byte slot for every kind, except strings, which are
+ * copied with their terminating NUL. Native byte order.
+ */
+
+/*
+ * Stream of records, written by cprintf_bin_write():
+ *	struct record_header hdr;
+ *	char payload[hdr.len];
+ * ID is offset of the record in cprintf_fmt section.
+ */
+struct record_header {
+	uint32_t	id;
+	uint32_t	len;
+};
+
+/* Longest payload, longer strings are truncated */
+#define RECORD_PAYLOAD_MAX	4096
+
+/* Encodes slots of record into buf, returns payload length */
+size_t record_encode(char *buf, size_t size, const char *rec,
+		const unsigned long long *slots);
+
+/*
+ * Formats record with payload into out like snprintf(): returns
+ * length of the whole text, -1 if payload doesn't match the record.
+ */
+int record_format(char *out, size_t size, const char *rec,
+		const char *payload, size_t len);
+
+#endif /* CPRINTF_RECORD_H */
@@ -0,0 +1,261 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cprintf-rt.h"
+#include "record.h"
+
+/*
+ * Per-thread SPSC ring buffers: the logging thread copies record
+ * pointer and encoded slots into it's own ring, background thread
+ * drains all rings, formats and writes text in large batches.
+ * Producers don't take locks: they wait only when their ring is full.
+ */
+#define RING_SIZE	(1 << 16)	/* power of 2 */
+#define OUT_SIZE	(1 << 16)	/* formatter batch */
+#define IDLE_NSEC	1000000		/* formatter poll interval */
+
+struct ring_entry {
+	const char	*rec;
+	int		fd;
+	unsigned int	len;		/* payload length */
+};
+
+struct ring {
+	_Atomic size_t	head;		/* written by producer */
+	_Atomic size_t	tail;		/* written by formatter */
+	_Atomic int	owned;		/* ring has a live thread */
+	struct ring	*next;
+	char		buf[RING_SIZE];
+};
+
+static _Atomic(struct ring *) rings;
+static __thread struct ring *my_ring;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+static pthread_t formatter;
+static atomic_int formatter_stop;
+static atomic_int formatter_done;	/* after the last drain */
+
+static void ring_put(struct ring *r, size_t pos, const void *data,
+		size_t len)
+{
+	size_t off = pos & (RING_SIZE - 1);
+	size_t first = len < RING_SIZE - off ? len : RING_SIZE - off;
+
+	memcpy(r->buf + off, data, first);
+	memcpy(r->buf, (const char *)data + first, len - first);
+}
+
+static void ring_get(struct ring *r, size_t pos, void *data, size_t len)
+{
+	size_t off = pos & (RING_SIZE - 1);
+	size_t first = len < RING_SIZE - off ? len : RING_SIZE - off;
+
+	memcpy(data, r->buf + off, first);
+	memcpy((char *)data + first, r->buf, len - first);
+}
+
+/* Output batch for one fd: flushed when fd changes or it's full */
+struct batch {
+	int	fd;
+	size_t	len;
+	char	buf[OUT_SIZE];
+};
+
+static void batch_flush(struct batch *b)
+{
+	size_t off = 0;
+
+	while (off < b->len) {
+		ssize_t n = write(b->fd, b->buf + off, b->len - off);
+
+		if (n <= 0)
+			break;
+		off += n;
+	}
+	b->len = 0;
+}
+
+static void batch_record(struct batch *b, const struct ring_entry *e,
+		const char *payload)
+{
+	int len;
+
+	if (b->fd != e->fd)
+		batch_flush(b);
+	b->fd = e->fd;
+
+	len = record_format(b->buf + b->len, OUT_SIZE - b->len,
+			e->rec, payload, e->len);
+	if (len >= 0 && (size_t)len >= OUT_SIZE - b->len) {
+		/* Doesn't fit: flush, longer ones are truncated */
+		batch_flush(b);
+		len = record_format(b->buf, OUT_SIZE, e->rec,
+				payload, e->len);
+		if (len >= OUT_SIZE)
+			len = OUT_SIZE - 1;
+	}
+	if (len > 0)
+		b->len += len;
+}
+
+/* Returns the number of drained records */
+static size_t ring_drain(struct ring *r, struct batch *b)
+{
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+	char payload[RECORD_PAYLOAD_MAX];
+	size_t n = 0;
+
+	while (tail != head) {
+		struct ring_entry e;
+
+		ring_get(r, tail, &e, sizeof(e));
+		ring_get(r, tail + sizeof(e), payload, e.len);
+		tail += sizeof(e) + e.len;
+		batch_record(b, &e, payload);
+		n++;
+	}
+	atomic_store_explicit(&r->tail, tail, memory_order_release);
+	return n;
+}
+
+static void *formatter_fn(void *arg __attribute__((unused)))
+{
+	static struct batch b;
+	const struct timespec idle = { .tv_sec = 0, .tv_nsec = IDLE_NSEC };
+
+	for (;;) {
+		int stop = atomic_load(&formatter_stop);
+		struct ring *r;
+		size_t n = 0;
+
+		/* Pairs with producer's fence: heads before stop are seen */
+		atomic_thread_fence(memory_order_seq_cst);
+		for (r = atomic_load(&rings); r != NULL; r = r->next)
+			n += ring_drain(r, &b);
+		batch_flush(&b);
+		/* The last pass after stop drains everything */
+		if (stop)
+			break;
+		if (n == 0)
+			nanosleep(&idle, NULL);
+	}
+	atomic_store(&formatter_done, 1);
+	return NULL;
+}
+
+/*
+ * Formatter is stopped: the caller drains its own ring, if it has one,
+ * after the formatter's last pass, and writes the record directly.
+ */
+static void ring_write_stopped(struct ring *r, const struct ring_entry *e,
+		const char *payload)
+{
+	struct batch b = { .fd = e->fd, .len = 0 };
+
+	while (r != NULL && !atomic_load(&formatter_done))
+		sched_yield();
+	if (r != NULL)
+		ring_drain(r, &b);
+	if (payload != NULL)
+		batch_record(&b, e, payload);
+	batch_flush(&b);
+}
+
+static void ring_release(void *arg)
+{
+	struct ring *r = arg;
+
+	/* Formatter still drains it, the next thread reuses it */
+	atomic_store(&r->owned, 0);
+}
+
+static void ring_at_exit(void)
+{
+	atomic_store(&formatter_stop, 1);
+	pthread_join(formatter, NULL);
+}
+
+static void ring_init(void)
+{
+	pthread_key_create(&ring_key, ring_release);
+	if (pthread_create(&formatter, NULL, formatter_fn, NULL))
+		abort();
+	atexit(ring_at_exit);
+}
+
+static struct ring *ring_get_mine(void)
+{
+	struct ring *r;
+	int unowned = 0;
+
+	if (my_ring != NULL)
+		return my_ring;
+	pthread_once(&ring_once, ring_init);
+
+	for (r = atomic_load(&rings); r != NULL; r = r->next) {
+		unowned = 0;
+		if (atomic_compare_exchange_strong(&r->owned, &unowned, 1))
+			break;
+	}
+	if (r == NULL) {
+		r = calloc(1, sizeof(*r));
+		if (r == NULL)
+			abort();
+		r->owned = 1;
+		r->next = atomic_load(&rings);
+		while (!atomic_compare_exchange_weak(&rings, &r->next, r))
+			;
+	}
+	pthread_setspecific(ring_key, r);
+	my_ring = r;
+	return r;
+}
+
+void cprintf_ring_write(int fd, const char *rec,
+		const unsigned long long *slots)
+{
+	struct ring *r;
+	char payload[RECORD_PAYLOAD_MAX];
+	struct ring_entry e;
+	size_t head, size;
+
+	e.rec = rec;
+	e.fd = fd;
+	e.len = record_encode(payload, sizeof(payload), rec, slots);
+	size = sizeof(e) + e.len;
+
+	/* Logging from atexit handlers: formatter is gone */
+	if (atomic_load_explicit(&formatter_stop, memory_order_relaxed)) {
+		ring_write_stopped(my_ring, &e, payload);
+		return;
+	}
+
+	r = ring_get_mine();
+	head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	/* Full ring: wait for formatter, logs aren't dropped */
+	while (head + size - atomic_load_explicit(&r->tail,
+				memory_order_acquire) > RING_SIZE) {
+		/* Nobody drains it anymore */
+		if (atomic_load(&formatter_stop)) {
+			ring_write_stopped(r, &e, payload);
+			return;
+		}
+		sched_yield();
+	}
+
+	ring_put(r, head, &e, sizeof(e));
+	ring_put(r, head + sizeof(e), payload, e.len);
+	atomic_store_explicit(&r->head, head + size, memory_order_release);
+
+	/* Stopped meanwhile: the last drain may have missed the record */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&formatter_stop, memory_order_relaxed))
+		ring_write_stopped(r, &e, NULL);
+}
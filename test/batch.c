@@ -0,0 +1,69 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+struct conn {
+	const char	*peer;
+	int		port;
+	int		state;
+	int		rx, tx;
+};
+
+static int brackets;
+
+void dump_begin(FILE *f)
+{
+	brackets++;
+	flockfile(f);
+}
+
+void dump_end(FILE *f)
+{
+	funlockfile(f);
+}
+
+void dump_str(FILE *f, const char *str)
+{
+	fputs(str, f);
+}
+
+void dump_int(FILE *f, int num)
+{
+	fprintf(f, "%d", num);
+}
+
+/* Plain version for build without plugin */
+void dump(FILE *f, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(f, fmt, args);
+	va_end(args);
+}
+
+/* Arguments are registers: nothing is read from memory between calls */
+static void dump_conn(FILE *f, const char *peer, int port, int state,
+		int rx, int tx)
+{
+	dump(f, "conn %s:%d {\n", peer, port);
+	dump(f, "\tstate: %d\n", state);
+	dump(f, "\trx: %d, tx: %d\n", rx, tx);
+	dump(f, "}\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct conn conns[] = {
+		{ "10.0.0.1", 80, 1, 100, 2000 },
+		{ "10.0.0.2", 443, 2, 0, -1 },
+		{ "localhost", 22, 0, 7, 7 },
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(conns) / sizeof(conns[0]); i++)
+		dump_conn(stdout, conns[i].peer, conns[i].port,
+				conns[i].state, conns[i].rx, conns[i].tx);
+
+	fprintf(stderr, "brackets: %d\n", brackets);
+	return 0;
+}
@@ -0,0 +1,33 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+/* Plain version for build without plugin */
+void log_bin(int fd, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vdprintf(fd, fmt, args);
+	va_end(args);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = { "zero", "one", "two", "three" };
+	double ratio = 1.0;
+	int i;
+
+	for (i = -2; i < 4; i++) {
+		const char *name = names[i < 0 ? 0 : i];
+
+		log_bin(1, "%d:\t%-6s|%*s| %x 100%%\n", i, name,
+				i * 3, name, i);
+		log_bin(1, "%lu %hhd %c %.3f %e\n",
+				(unsigned long)i * 1000000007, i * 100,
+				'a' + i + 2, ratio, ratio * 1e10);
+		ratio /= 3;
+	}
+	log_bin(1, "done\n");
+
+	return 0;
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <string.h>
+
+char *buf_ulong(char *cur, unsigned long num)
+{
+	char buf[20], *s = &buf[sizeof(buf)];
+
+	do {
+		*--s = (num % 10) + '0';
+		num /= 10;
+	} while (num);
+	memcpy(cur, s, &buf[sizeof(buf)] - s);
+	return cur + (&buf[sizeof(buf)] - s);
+}
+
+char *buf_int(char *cur, int num)
+{
+	if (num < 0) {
+		*cur++ = '-';
+		return buf_ulong(cur, -(unsigned long)num);
+	}
+	return buf_ulong(cur, num);
+}
+
+char *buf_str(char *cur, const char *str)
+{
+	size_t len = strlen(str);
+
+	memcpy(cur, str, len);
+	return cur + len;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = { "zero", "one", "two", "three" };
+	char buf[64], small[8];
+	size_t size;
+	int i, n;
+
+	for (i = -1; i < 3; i++) {
+		n = sprintf(buf, "fd:%d pos:%lu", i,
+				(unsigned long)i * 1000000007);
+		printf("%s|%d\n", buf, n);
+		n = sprintf(buf, "/proc/%d/%s", i, names[i < 0 ? 0 : i]);
+		printf("%s|%d\n", buf, n);
+
+		/* doesn't fit: truncated */
+		memset(small, 'x', sizeof(small));
+		n = snprintf(small, sizeof(small), "fd:%d pos:%lu", i,
+				(unsigned long)i * 1000000007);
+		printf("%s|%d\n", small, n);
+		/* fits */
+		n = snprintf(buf, sizeof(buf), "[%d]", i);
+		printf("%s|%d\n", buf, n);
+	}
+
+	for (size = 0; size < 6; size++) {
+		memset(small, 'x', sizeof(small));
+		small[sizeof(small) - 1] = '\0';
+		n = snprintf(small, size, "%d-%d", (int)size * 11, -(int)size);
+		printf("%s|%d\n", small, n);
+	}
+
+	return 0;
+}
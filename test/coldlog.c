@@ -0,0 +1,49 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+static int plain_calls;
+
+void log_str(FILE *f, const char *str)
+{
+	fputs(str, f);
+}
+
+void log_int(FILE *f, int num)
+{
+	fprintf(f, "%d", num);
+}
+
+/* Plain version for build without plugin and for cold sites */
+void log_msg(FILE *f, const char *fmt, ...)
+{
+	va_list args;
+
+	plain_calls++;
+	va_start(args, fmt);
+	vfprintf(f, fmt, args);
+	va_end(args);
+}
+
+static void __attribute__((cold, noinline)) fail(int step)
+{
+	log_msg(stdout, "failed at step %d of %d\n", step, 10);
+	/* Small enough to be expanded anyway */
+	log_msg(stdout, "bye\n");
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	for (i = 0; i < 10; i++) {
+		log_msg(stdout, "step %d\n", i);
+		if (unlikely(i == 7))
+			log_msg(stdout, "odd step %d: %s\n", i, "seven");
+	}
+	fail(i);
+
+	fprintf(stderr, "plain calls: %d\n", plain_calls);
+	return 0;
+}
@@ -0,0 +1,44 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+static int plain_calls;
+
+void log_str(FILE *f, const char *str)
+{
+	fputs(str, f);
+}
+
+void log_int(FILE *f, int num)
+{
+	fprintf(f, "%d", num);
+}
+
+/* Plain version for build without plugin and for cold sites */
+void log_msg(FILE *f, const char *fmt, ...)
+{
+	va_list args;
+
+	plain_calls++;
+	va_start(args, fmt);
+	vfprintf(f, fmt, args);
+	va_end(args);
+}
+
+/*
+ * No static hints: training run without arguments makes the loop hot
+ * and the argument report never executed, i.e. cold.
+ */
+int main(int argc, char **argv)
+{
+	int i, sum = 0;
+
+	for (i = 0; i < 100; i++) {
+		sum += i;
+		log_msg(stdout, "step %d sum %d\n", i, sum);
+	}
+	if (argc > 1)
+		log_msg(stdout, "extra %s after %d steps\n", argv[1], i);
+
+	fprintf(stderr, "plain calls: %d\n", plain_calls);
+	return 0;
+}
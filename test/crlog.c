@@ -2,6 +2,8 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 
+#include "../rt/cprintf-rt.h"
+
 void __puts(const char *str)
 {
 	fputs(str, stdout);
@@ -9,72 +11,23 @@ void __puts(const char *str)
 
 void __putlong(long num)
 {
-	int neg = 0;
-	char buf[22], *s;
-
-	buf[21] = '\0';
-	s = &buf[20];
-
-	if (num < 0) {
-		neg = 1;
-		num = -num;
-	} else if (num == 0) {
-		*s = '0';
-		s--;
-		goto done;
-	}
+	char buf[20];
 
-	while (num > 0) {
-		*s = (num % 10) + '0';
-		s--;
-		num /= 10;
-	}
-
-	if (neg) {
-		*s = '-';
-		s--;
-	}
-done:
-	s++;
-	fputs(s, stdout);
+	fwrite(buf, 1, cprintf_fmt_long(buf, num), stdout);
 }
 
 void __putshort(short num)
 {
-	int neg = 0;
-	char buf[12], *s;
-
-	buf[11] = '\0';
-	s = &buf[10];
-
-	if (num < 0) {
-		neg = 1;
-		num = -num;
-	} else if (num == 0) {
-		*s = '0';
-		s--;
-		goto done;
-	}
-
-	while (num > 0) {
-		*s = (num % 10) + '0';
-		s--;
-		num /= 10;
-	}
+	char buf[20];
 
-	if (neg) {
-		*s = '-';
-		s--;
-	}
-done:
-	s++;
-	fputs(s, stdout);
+	fwrite(buf, 1, cprintf_fmt_int(buf, num), stdout);
 }
 
 void __putulong(unsigned long num)
 {
-	/* XXX: make ul version */
-	__putlong((long)num);
+	char buf[20];
+
+	fwrite(buf, 1, cprintf_fmt_ulong(buf, num), stdout);
 }
 
 void __putwrite(const char *str, size_t size, size_t nmemb)
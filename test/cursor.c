@@ -0,0 +1,106 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char line[256];
+static size_t reserved = sizeof(line);
+
+/* %^ hook: the line won't be longer than len */
+static inline void cur_reserve(int fd, size_t len)
+{
+	if (len > sizeof(line))
+		abort();
+	reserved = len;
+}
+
+/* %{ and %} hooks: hand out the buffer and write filled part */
+static inline char *cur_begin(int fd)
+{
+	return line;
+}
+
+static inline void cur_commit(int fd, char *cur)
+{
+	if ((size_t)(cur - line) > reserved)
+		abort();
+	reserved = sizeof(line);
+	write(fd, line, cur - line);
+}
+
+static inline char *cur_char(char *cur, char c)
+{
+	*cur++ = c;
+	return cur;
+}
+
+static inline char *cur_str(char *cur, const char *str)
+{
+	size_t len = strlen(str);
+
+	memcpy(cur, str, len);
+	return cur + len;
+}
+
+static inline char *cur_mem(char *cur, const char *ptr,
+		size_t size, size_t nmemb)
+{
+	memcpy(cur, ptr, size * nmemb);
+	return cur + size * nmemb;
+}
+
+static inline char *cur_ulong(char *cur, unsigned long num)
+{
+	char buf[20], *s = &buf[sizeof(buf)];
+
+	do {
+		*--s = (num % 10) + '0';
+		num /= 10;
+	} while (num);
+	memcpy(cur, s, &buf[sizeof(buf)] - s);
+	return cur + (&buf[sizeof(buf)] - s);
+}
+
+static inline char *cur_long(char *cur, long num)
+{
+	if (num < 0) {
+		*cur++ = '-';
+		return cur_ulong(cur, -(unsigned long)num);
+	}
+	return cur_ulong(cur, num);
+}
+
+static inline char *cur_int(char *cur, int num)
+{
+	return cur_long(cur, num);
+}
+
+/* Plain version for build without plugin */
+int cur_printf(int fd, const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	ret = vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+	write(fd, line, ret);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = { "zero", "one", "two", "three" };
+	long i;
+
+	for (i = -2; i < 4; i++)
+		cur_printf(1, "%ld:\t%s %d%%\n", i, names[i < 0 ? 0 : i],
+				(int)i * 25);
+	for (i = 0; i < 3; i++)
+		cur_printf(1, "%lu/%d%c\n", (unsigned long)i * 1000000007,
+				(int)i, names[i][0]);
+	cur_printf(1, "done\n");
+
+	return 0;
+}
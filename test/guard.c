@@ -0,0 +1,54 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+enum { LOG_ERR, LOG_INFO, LOG_DEBUG };
+
+static int log_level = LOG_INFO;
+
+int log_enabled(int level)
+{
+	return level <= log_level;
+}
+
+void print_str_level(int level, const char *str)
+{
+	if (log_enabled(level))
+		fputs(str, stdout);
+}
+
+void print_int_level(int level, int num)
+{
+	if (log_enabled(level))
+		printf("%d", num);
+}
+
+void print_on_level(int level, const char *fmt, ...)
+{
+	va_list args;
+
+	if (!log_enabled(level))
+		return;
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+struct regs {
+	int cwd, swd, twd;
+};
+
+int main(int argc, char **argv)
+{
+	struct regs r = { 0x37f, 0, 0xffff }, *p = &r;
+	int i, counter = 0;
+
+	for (i = LOG_ERR; i <= LOG_DEBUG; i++) {
+		print_on_level(i, "level %d: cwd:%d swd:%d twd:%d\n",
+				i, p->cwd, p->swd, p->twd * 2);
+		print_on_level(i, "counter %d\n", counter++);
+	}
+	print_on_level(LOG_ERR, "counter is %d\n", counter);
+	print_on_level(LOG_DEBUG, "debug only: %d\n", counter);
+
+	return 0;
+}
@@ -0,0 +1,71 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "../rt/cprintf-rt.h"
+
+struct regs {
+	unsigned short	cwd, swd, twd, fop;
+	unsigned int	mxcsr, mxcsr_mask;
+	unsigned long	rip, rdp;
+};
+
+void dump_str(const char *str)
+{
+	fputs(str, stdout);
+}
+
+void dump_hex(unsigned int num)
+{
+	char buf[16];
+
+	fwrite(buf, 1, cprintf_fmt_hex(buf, num), stdout);
+}
+
+void dump_hex8(unsigned int num)
+{
+	char buf[8];
+
+	fwrite(buf, 1, cprintf_fmt_hex8(buf, num), stdout);
+}
+
+void dump_hex16(unsigned long num)
+{
+	char buf[16];
+
+	fwrite(buf, 1, cprintf_fmt_hex16(buf, num), stdout);
+}
+
+void dump_ptr(const void *ptr)
+{
+	char buf[18];
+
+	fwrite(buf, 1, cprintf_fmt_ptr(buf, ptr), stdout);
+}
+
+/* Plain version for build without plugin */
+void dump(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+int main(int argc, char **argv)
+{
+	struct regs r = { 0x37f, 0, 0xffff, 0x1d, 0x1f80, 0xffbf,
+		0xffffffff81000000UL, 0x7ffc2a3b4c50UL };
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		dump("cwd:%x swd:%x twd:%x fop:%x mxcsr:%08x mxcsr_mask:%08x\n",
+				(int)r.cwd, (int)r.swd, (int)r.twd,
+				(int)r.fop, r.mxcsr, r.mxcsr_mask);
+		dump("rip:%016lx rdp:%016lx at %p\n", r.rip, r.rdp,
+				(void *)(r.rdp & -i));
+		r.swd += 0x1111 * i;
+		r.rip += 0x10 << i;
+	}
+	return 0;
+}
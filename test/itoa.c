@@ -0,0 +1,215 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../rt/cprintf-rt.h"
+
+/*
+ * Checks integer and hex kernels against snprintf(); with `bench'
+ * argument compares their speed with printf() formatting.
+ */
+#define BENCH_ITER	20000000
+
+static unsigned long long next_rand(unsigned long long *state)
+{
+	/* xorshift64 */
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static int check(unsigned long long v)
+{
+	char want[32], got[32];
+	int fails = 0;
+	size_t len;
+
+#define CHECK(fmt, func, type)						\
+	do {								\
+		snprintf(want, sizeof(want), fmt, (type)v);		\
+		len = func(got, (type)v);				\
+		got[len] = '\0';					\
+		if (strcmp(want, got)) {				\
+			fprintf(stderr, #func ": want %s, got %s\n",	\
+					want, got);			\
+			fails++;					\
+		}							\
+	} while (0)
+
+	CHECK("%d", cprintf_fmt_int, int);
+	CHECK("%u", cprintf_fmt_uint, unsigned int);
+	CHECK("%ld", cprintf_fmt_long, long);
+	CHECK("%lu", cprintf_fmt_ulong, unsigned long);
+	CHECK("%lld", cprintf_fmt_llong, long long);
+	CHECK("%llu", cprintf_fmt_ullong, unsigned long long);
+	CHECK("%llx", cprintf_fmt_hex, unsigned long long);
+	CHECK("%llX", cprintf_fmt_hex_upper, unsigned long long);
+	CHECK("%08x", cprintf_fmt_hex8, unsigned int);
+	CHECK("%016llx", cprintf_fmt_hex16, unsigned long long);
+	CHECK("%p", cprintf_fmt_ptr, void *);
+#undef CHECK
+	return fails;
+}
+
+static int check_float(double v, int prec)
+{
+	char want[512], got[512];
+	int fails = 0;
+
+#define CHECK(fmt, func)						\
+	do {								\
+		snprintf(want, sizeof(want), fmt, prec, v);		\
+		func(got, sizeof(got), v, prec);			\
+		if (strcmp(want, got)) {				\
+			fprintf(stderr, #func "(%.17g, %d): want %s, "	\
+					"got %s\n", v, prec, want, got);\
+			fails++;					\
+		}							\
+	} while (0)
+
+	CHECK("%.*f", cprintf_fmt_f);
+	CHECK("%.*e", cprintf_fmt_e);
+	CHECK("%.*g", cprintf_fmt_g);
+#undef CHECK
+	return fails;
+}
+
+static double rand_double(unsigned long long *state)
+{
+	unsigned long long r = next_rand(state);
+	double v;
+
+	/* random mantissa with exponent from 2^-80 to 2^80 */
+	r = (r & 0x800fffffffffffffULL) |
+		((unsigned long long)(1023 - 80 + (r >> 52) % 161) << 52);
+	memcpy(&v, &r, sizeof(v));
+	return v;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(void)
+{
+	unsigned long long state = 88172645463325252ULL;
+	size_t i, sum = 0;
+	char buf[32];
+	double start;
+
+	start = now();
+	for (i = 0; i < BENCH_ITER; i++)
+		sum += snprintf(buf, sizeof(buf), "%ld",
+				(long)(next_rand(&state) >> (i & 63)));
+	printf("snprintf(\"%%ld\")\t%6.2f ns/call\n",
+			(now() - start) * 1e9 / BENCH_ITER);
+
+	start = now();
+	for (i = 0; i < BENCH_ITER; i++)
+		sum += cprintf_fmt_long(buf,
+				(long)(next_rand(&state) >> (i & 63)));
+	printf("cprintf_fmt_long\t%6.2f ns/call\n",
+			(now() - start) * 1e9 / BENCH_ITER);
+
+	start = now();
+	for (i = 0; i < BENCH_ITER; i++)
+		sum += snprintf(buf, sizeof(buf), "%016lx",
+				(unsigned long)next_rand(&state));
+	printf("snprintf(\"%%016lx\")\t%6.2f ns/call\n",
+			(now() - start) * 1e9 / BENCH_ITER);
+
+	start = now();
+	for (i = 0; i < BENCH_ITER; i++)
+		sum += cprintf_fmt_hex16(buf, next_rand(&state));
+	printf("cprintf_fmt_hex16\t%6.2f ns/call\n",
+			(now() - start) * 1e9 / BENCH_ITER);
+
+	start = now();
+	for (i = 0; i < BENCH_ITER; i++)
+		sum += snprintf(buf, sizeof(buf), "%.3f",
+				(double)(next_rand(&state) % 100000000) / 1000);
+	printf("snprintf(\"%%.3f\")\t%6.2f ns/call\n",
+			(now() - start) * 1e9 / BENCH_ITER);
+
+	start = now();
+	for (i = 0; i < BENCH_ITER; i++)
+		sum += cprintf_fmt_f(buf, sizeof(buf),
+				(double)(next_rand(&state) % 100000000) / 1000, 3);
+	printf("cprintf_fmt_f\t\t%6.2f ns/call\n",
+			(now() - start) * 1e9 / BENCH_ITER);
+
+	start = now();
+	for (i = 0; i < BENCH_ITER; i++)
+		sum += snprintf(buf, sizeof(buf), "%g",
+				(double)(next_rand(&state) % 100000000) / 1000);
+	printf("snprintf(\"%%g\")\t%6.2f ns/call\n",
+			(now() - start) * 1e9 / BENCH_ITER);
+
+	start = now();
+	for (i = 0; i < BENCH_ITER; i++)
+		sum += cprintf_fmt_g(buf, sizeof(buf),
+				(double)(next_rand(&state) % 100000000) / 1000, -1);
+	printf("cprintf_fmt_g\t\t%6.2f ns/call\n",
+			(now() - start) * 1e9 / BENCH_ITER);
+
+	/* Keep the results alive */
+	if (sum == 0)
+		abort();
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long state = 88172645463325252ULL;
+	unsigned long long v;
+	int fails = 0;
+	int i, j;
+
+	/* Around every power of 10 and 2, edges of types */
+	for (i = 0, v = 1; i < 20; i++, v *= 10)
+		for (j = -2; j <= 2; j++) {
+			fails += check(v + j);
+			fails += check(-(v + j));
+		}
+	for (i = 0; i < 64; i++)
+		for (j = -1; j <= 1; j++)
+			fails += check((1ULL << i) + j);
+	fails += check(LLONG_MIN);
+	fails += check(LLONG_MAX);
+	fails += check(ULLONG_MAX);
+	for (i = 0; i < 1000000; i++)
+		fails += check(next_rand(&state) >> (i & 63));
+
+	/* Ties, carries into the next digit and precision edges */
+	{
+		static const double vals[] = {
+			0.0, -0.0, 0.5, 1.5, 2.5, 0.125, 0.375, 1.005,
+			9.9999995, 99.5, 999999.5, 0.00001, 0.0001234,
+			123456789.0, 1e15, 1e16 + 2, 1e17, 5e-324,
+			1.7976931348623157e308, 1.0 / 3, 2.0 / 3,
+		};
+
+		for (i = 0; i < (int)(sizeof(vals) / sizeof(vals[0])); i++)
+			for (j = -1; j <= 17; j++) {
+				fails += check_float(vals[i], j);
+				fails += check_float(-vals[i], j);
+			}
+	}
+	for (i = 0; i < 200000; i++)
+		fails += check_float(rand_double(&state), i % 19 - 1);
+	for (i = 0; i < 100000; i++)
+		fails += check_float((double)(next_rand(&state) % 100000) /
+				(i % 2 ? 1000 : 8), i % 5);
+
+	if (fails)
+		return 1;
+	if (argc > 1 && !strcmp(argv[1], "bench"))
+		bench();
+	return 0;
+}
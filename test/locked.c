@@ -0,0 +1,72 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#define THREADS	4
+#define LINES	2000
+
+void put_str(FILE *f, const char *str)
+{
+	fputs(str, f);
+}
+
+void put_str_unlocked(FILE *f, const char *str)
+{
+	fputs_unlocked(str, f);
+}
+
+void put_int(FILE *f, int num)
+{
+	fprintf(f, "%d", num);
+}
+
+void put_int_unlocked(FILE *f, int num)
+{
+	char buf[12], *s = &buf[sizeof(buf)];
+	unsigned int n = num < 0 ? -(unsigned int)num : num;
+
+	do {
+		*--s = n % 10 + '0';
+		n /= 10;
+	} while (n);
+	if (num < 0)
+		*--s = '-';
+	fwrite_unlocked(s, 1, &buf[sizeof(buf)] - s, f);
+}
+
+/* Plain version for build without plugin */
+void out(FILE *f, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(f, fmt, args);
+	va_end(args);
+}
+
+static void *worker(void *arg)
+{
+	long id = (long)arg;
+	int i;
+
+	for (i = 0; i < LINES; i++) {
+		out(stdout, "thread %d: line %d of %d, piece %d %d %d\n",
+				(int)id, i, LINES, i * 2, i * 3, -i);
+		out(stdout, "tick\n");
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t threads[THREADS];
+	long i;
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	return 0;
+}
@@ -0,0 +1,86 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../rt/cprintf-rt.h"
+
+void m_str(const char *str)
+{
+	fputs(str, stdout);
+}
+
+void m_int(int num)
+{
+	char buf[20];
+
+	fwrite(buf, 1, cprintf_fmt_int(buf, num), stdout);
+}
+
+void m_f(double v)
+{
+	char buf[64];
+	size_t len = cprintf_fmt_f(buf, sizeof(buf), v, -1);
+
+	fwrite(buf, 1, len < sizeof(buf) ? len : strlen(buf), stdout);
+}
+
+void m_f2(double v)
+{
+	char buf[64];
+	size_t len = cprintf_fmt_f(buf, sizeof(buf), v, 2);
+
+	fwrite(buf, 1, len < sizeof(buf) ? len : strlen(buf), stdout);
+}
+
+void m_e(double v)
+{
+	char buf[64];
+
+	fwrite(buf, 1, cprintf_fmt_e(buf, sizeof(buf), v, -1), stdout);
+}
+
+void m_g(double v)
+{
+	char buf[64];
+
+	fwrite(buf, 1, cprintf_fmt_g(buf, sizeof(buf), v, -1), stdout);
+}
+
+/* %~f: right-justified in width, precision from format */
+void m_fmt_f(unsigned int flags, int width, int prec, double v)
+{
+	char buf[64];
+	size_t len = cprintf_fmt_f(buf, sizeof(buf), v, prec);
+
+	if (len >= sizeof(buf))
+		len = strlen(buf);
+	for (; width > (int)len; width--)
+		putchar(' ');
+	fwrite(buf, 1, len, stdout);
+}
+
+/* Plain version for build without plugin */
+void metric(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+int main(int argc, char **argv)
+{
+	double latency = 0.125, rate = 1000.0 / 3;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		metric("%d: latency %f ms, p99 %.2f ms, rate %g/s\n", i,
+				latency, latency * 2.5, rate);
+		metric("%d: bytes %e, ratio %8.3f|%.0f\n", i, rate * 1e6,
+				latency / rate, rate);
+		latency = latency * 3 + 0.001;
+		rate /= -7;
+	}
+	return 0;
+}
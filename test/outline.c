@@ -0,0 +1,57 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+void log_str(FILE *f, const char *str)
+{
+	fputs(str, f);
+}
+
+void log_int(FILE *f, int num)
+{
+	fprintf(f, "%d", num);
+}
+
+/* Plain version for build without plugin */
+void log_msg(FILE *f, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(f, fmt, args);
+	va_end(args);
+}
+
+static int checksum(const int *data, int n)
+{
+	int i, sum = 0;
+
+	for (i = 0; i < n; i++) {
+		if (data[i] < 0)
+			log_msg(stdout, "bad value %d at %d\n", data[i], i);
+		sum += data[i];
+	}
+	return sum;
+}
+
+static int maximum(const int *data, int n)
+{
+	int i, max = data[0];
+
+	for (i = 1; i < n; i++) {
+		if (data[i] < 0)
+			log_msg(stdout, "bad value %d at %d\n", data[i], i);
+		if (data[i] > max)
+			max = data[i];
+	}
+	return max;
+}
+
+int main(int argc, char **argv)
+{
+	int data[] = { 3, -1, 4, 1, -5, 9, 2, 6 };
+	int n = sizeof(data) / sizeof(data[0]);
+
+	log_msg(stdout, "sum %d, max %d of %s\n", checksum(data, n),
+			maximum(data, n), "data");
+	return 0;
+}
@@ -0,0 +1,32 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+void say_str(const char *str)
+{
+	fputs(str, stdout);
+}
+
+void say_int(int num)
+{
+	printf("%d", num);
+}
+
+void say(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	/* With 1/3 limit: 4 lines of 10 */
+	for (i = 0; i < 10; i++)
+		say("storm %d of %d\n", i, 10);
+
+	return 0;
+}
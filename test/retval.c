@@ -0,0 +1,65 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int out_str(int fd, const char *str)
+{
+	return write(fd, str, strlen(str));
+}
+
+int out_char(int fd, char c)
+{
+	return write(fd, &c, 1);
+}
+
+int out_int(int fd, int num)
+{
+	unsigned int n = num;
+	char buf[12], *s = &buf[sizeof(buf)];
+
+	if (num < 0)
+		n = -n;
+	do {
+		*--s = (n % 10) + '0';
+		n /= 10;
+	} while (n);
+	if (num < 0)
+		*--s = '-';
+	return write(fd, s, &buf[sizeof(buf)] - s);
+}
+
+/* Plain version for build without plugin */
+int out_printf(int fd, const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	ret = vdprintf(fd, fmt, args);
+	va_end(args);
+	return ret;
+}
+
+struct stats {
+	int last;
+};
+
+int main(int argc, char **argv)
+{
+	struct stats st;
+	int i, n, total = 0;
+
+	for (i = -10; i < 1000; i += 333) {
+		n = out_printf(1, "%d: %s\n", i, i < 0 ? "neg" : "pos");
+		total += n;
+		out_printf(1, "len=%d\n", n);
+	}
+	st.last = out_printf(1, "total=%d\n", total);
+	out_printf(1, "%d\n", st.last);
+
+	if (out_printf(-1, "%d bytes to nowhere\n", total) < 0)
+		out_printf(1, "error\n");
+
+	return 0;
+}
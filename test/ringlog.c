@@ -0,0 +1,41 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#define THREADS	4
+#define LINES	10000
+
+/* Plain version for build without plugin */
+void log_ring(int fd, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vdprintf(fd, fmt, args);
+	va_end(args);
+}
+
+static void *worker(void *arg)
+{
+	long id = (long)arg;
+	int i;
+
+	for (i = 0; i < LINES; i++)
+		log_ring(1, "thread %ld: line %d of %s, %x\n", id, i,
+				"worker", i * 7);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t threads[THREADS];
+	long i;
+
+	for (i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+	log_ring(1, "done\n");
+
+	return 0;
+}
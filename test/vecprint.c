@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+
+void vec_str(struct iovec *slot, char *scratch, const char *str)
+{
+	slot->iov_base = (void *)str;
+	slot->iov_len = strlen(str);
+}
+
+void vec_int(struct iovec *slot, char *scratch, int num)
+{
+	unsigned int n = num;
+	char buf[12], *s = &buf[sizeof(buf)];
+
+	if (num < 0)
+		n = -n;
+	do {
+		*--s = (n % 10) + '0';
+		n /= 10;
+	} while (n);
+	if (num < 0)
+		*--s = '-';
+
+	slot->iov_len = &buf[sizeof(buf)] - s;
+	memcpy(scratch, s, slot->iov_len);
+	slot->iov_base = scratch;
+}
+
+/* %~d: flags, width and precision are compile-time constants */
+void vec_fmt_int(struct iovec *slot, char *scratch,
+		unsigned int flags, int width, int prec, int num)
+{
+	char pad = (flags & 16 /* '0' */) ? '0' : ' ';
+	size_t len;
+
+	vec_int(slot, scratch, num);
+	len = slot->iov_len;
+	if (width < 0 || len >= (size_t)width)
+		return;
+
+	if (flags & 1 /* '-' */) {
+		memset(scratch + len, ' ', width - len);
+	} else {
+		memmove(scratch + width - len, scratch, len);
+		memset(scratch, pad, width - len);
+	}
+	slot->iov_len = width;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = { "zero", "one", "two", "three" };
+	int i;
+
+	for (i = -2; i < 4; i++)
+		dprintf(1, "%d:\t%s %d%%\n", i, names[i < 0 ? 0 : i], i * 25);
+	for (i = 0; i < 3; i++)
+		dprintf(1, "[%4d] [%-4d] [%04d]\n", i * 7, i, i + 10);
+	for (i = 0; i < 4; i++)
+		dprintf(1, "%2$s=%1$d (%2$s)\n", i, names[i]);
+	dprintf(1, "done\n");
+
+	return 0;
+}